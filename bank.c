@@ -0,0 +1,151 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Library header inclusion for linking
+#include "sidesplitter.h"
+#include "bank.h"
+
+// Recently used filter tables
+static bank_entry bank[FILTER_BANK];
+static uint64_t bank_age = 0;
+static pthread_mutex_t bank_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Weight below which coefficients are skipped - negative visits all
+static double band_eps = -1.0;
+
+void set_filter_eps(double eps){
+  pthread_mutex_lock(&bank_lock);
+  if (eps != band_eps){
+    // Bands of banked tables no longer apply
+    band_eps = eps;
+    pthread_mutex_unlock(&bank_lock);
+    free_filters();
+    return;
+  }
+  pthread_mutex_unlock(&bank_lock);
+  return;
+}
+
+// Return table for squared resolutions hires and lores - lowpass if lores < 0
+filter *get_filter(int32_t full, double hires, double lores){
+  int32_t i, slot = -1;
+  filter *table;
+  pthread_mutex_lock(&bank_lock);
+  for (i = 0; i < FILTER_BANK; i++){
+    if (bank[i].table && bank[i].full == full && bank[i].hires == hires && bank[i].lores == lores){
+      bank[i].refs++;
+      bank[i].age = ++bank_age;
+      table = bank[i].table;
+      pthread_mutex_unlock(&bank_lock);
+      return table;
+    }
+    // Replace the oldest table not in use
+    if (!bank[i].refs && (slot < 0 || !bank[i].table || (bank[slot].table && bank[i].age < bank[slot].age))){
+      slot = i;
+    }
+  }
+  table = make_filter(full, hires, lores, band_eps);
+  if (slot >= 0){
+    free_filter(bank[slot].table);
+    bank[slot].table = table;
+    bank[slot].hires = hires;
+    bank[slot].lores = lores;
+    bank[slot].full = full;
+    bank[slot].refs = 1;
+    bank[slot].age = ++bank_age;
+  }
+  pthread_mutex_unlock(&bank_lock);
+  return table;
+}
+
+// Release table from get_filter
+void put_filter(filter *table){
+  int32_t i;
+  pthread_mutex_lock(&bank_lock);
+  for (i = 0; i < FILTER_BANK; i++){
+    if (bank[i].table == table){
+      bank[i].refs--;
+      pthread_mutex_unlock(&bank_lock);
+      return;
+    }
+  }
+  pthread_mutex_unlock(&bank_lock);
+  // Tables made while the bank was full are not kept
+  free_filter(table);
+  return;
+}
+
+// Release all banked tables
+void free_filters(void){
+  int32_t i;
+  pthread_mutex_lock(&bank_lock);
+  for (i = 0; i < FILTER_BANK; i++){
+    free_filter(bank[i].table);
+    bank[i].table = NULL;
+    bank[i].refs = 0;
+  }
+  pthread_mutex_unlock(&bank_lock);
+  return;
+}
+
+// Squared radii are integers so each response is evaluated exactly once
+// r2 / dim^2 is within 7 * 2^-53 of the per-voxel sum of squared frequencies - exact for power of two boxes
+// Butterworth slopes scale that by at most 4, so responses differ by under 4e-15 (6.7e-16 seen up to 360^3)
+filter *make_filter(int32_t full, double hires, double lores, double eps){
+  int32_t half = full / 2;
+  int64_t r2, radii = 3 * (int64_t) half * half + 1;
+  double dim = (double) full;
+  double scale = 1.0 / (dim * dim);
+  double norms, *table = malloc(radii * sizeof(double));
+  filter *arg = malloc(sizeof(filter));
+  arg->table = table;
+  arg->lo = 0;
+  arg->hi = (uint32_t) (radii - 1);
+  for (r2 = 0; r2 < radii; r2++){
+    norms = (double) r2 * scale;
+    table[r2] = sqrt(1.0 / (1.0 + pow((norms / hires), 8.0)));
+    if (lores >= 0.0){
+      table[r2] -= sqrt(1.0 / (1.0 + pow((norms / lores), 8.0)));
+    }
+  }
+  if (eps < 0.0){
+    return arg;
+  }
+  // Narrow to the annulus where the weight exceeds eps
+  for (r2 = 0; r2 < radii && fabs(table[r2]) <= eps; r2++);
+  if (r2 == radii){
+    // Empty band
+    arg->lo = 1;
+    arg->hi = 0;
+    return arg;
+  }
+  arg->lo = (uint32_t) r2;
+  for (r2 = radii - 1; fabs(table[r2]) <= eps; r2--);
+  arg->hi = (uint32_t) r2;
+  return arg;
+}
+
+void free_filter(filter *arg){
+  if (arg){
+    free(arg->table);
+    free(arg);
+  }
+  return;
+}
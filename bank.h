@@ -0,0 +1,52 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Inclusions
+#include <stdio.h>
+#include <signal.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <complex.h>
+#include <fftw3.h>
+
+// Filter tables kept at once
+#define FILTER_BANK 8
+
+// Filter bank entry structure
+typedef struct{
+  filter    *table;
+  double     hires;
+  double     lores;
+  int32_t     full;
+  int32_t     refs;
+  uint64_t     age;
+} bank_entry;
+
+filter *make_filter(int32_t full, double hires, double lores, double eps);
+// Tabulate Butterworth response by squared radius
+// Band spans radii with weight over eps
+
+void free_filter(filter *arg);
+// Release table
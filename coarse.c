@@ -0,0 +1,318 @@
+
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Library header inclusion for linking
+#include "sidesplitter.h"
+#include "coarse.h"
+
+// Spectrum of the statistics mask cropped to the largest coarse box and its weights by box
+static fftw_complex *spectrum = NULL;
+static real_t **weights = NULL;
+static double voxels = 0.0;
+static int32_t grid_full = 0;
+static int32_t grid_max = 0;
+static pthread_mutex_t weights_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Smallest box from n that FFTW factors into small transforms
+int32_t fft_size(int32_t n){
+  int32_t m, r, i, primes[4] = {2, 3, 5, 7};
+  for (m = (n > 1) ? n : 1; ; m++){
+    r = m;
+    for (i = 0; i < 4; i++){
+      while (!(r % primes[i])){
+        r /= primes[i];
+      }
+    }
+    if (r == 1){
+      return m;
+    }
+  }
+}
+
+// Mask statistics are quadratic in band limited maps so they hold exactly on a box twice the band
+void set_coarse(r_mrc *mask, fftw_complex *k, real_t *r, int32_t full, int32_t nthreads){
+  int32_t pitch = real_pitch(full), x;
+  int64_t row;
+  float *in;
+  fftw_plan plan;
+  // Largest friendly box worth cropping to
+  for (grid_max = full - 1; grid_max > 0; grid_max--){
+    if (fft_size(grid_max) == grid_max && (int64_t) COARSE_SHARE * grid_max * grid_max * grid_max <= (int64_t) full * full * full){
+      break;
+    }
+  }
+  grid_full = full;
+  voxels = 0.0;
+  fftw_plan_with_nthreads(nthreads);
+  plan = plan_r2c(full, r, k, FFTW_ESTIMATE);
+  // Same cut as the statistics use
+  for (row = 0; row < (int64_t) full * full; row++){
+    in = mask->data + row * full;
+    for (x = 0; x < full; x++){
+      r[row * pitch + x] = (in[x] < 0.99) ? 0.0 : 1.0;
+      voxels += r[row * pitch + x];
+    }
+  }
+  fftw_execute(plan);
+  fftw_destroy_plan(plan);
+  spectrum = fftw_malloc((int64_t) grid_max * grid_max * (grid_max / 2 + 1) * sizeof(fftw_complex));
+  crop_fourier(k, full, 1, spectrum, grid_max, (grid_max - 1) / 2, nthreads);
+  weights = calloc(grid_max + 1, sizeof(real_t *));
+  return;
+}
+
+// Products of two maps within radius R reach 2R - with the mask beside them a box over 4R wraps none onto the mean
+int32_t coarse_size(uint32_t hi){
+  int32_t size;
+  if (!grid_max){
+    return 0;
+  }
+  size = fft_size(4 * band_radius(hi) + 1);
+  return (size <= grid_max) ? size : 0;
+}
+
+// Mask weights keep the mask spectrum the coarse box holds
+real_t *coarse_mask(int32_t size){
+  int64_t voxel, count = (int64_t) size * size * size;
+  double scale = 1.0 / ((double) grid_full * grid_full * grid_full);
+  fftw_complex *k;
+  fftw_plan plan;
+  real_t *w;
+  pthread_mutex_lock(&weights_lock);
+  if (!weights[size]){
+    k = fftw_malloc((int64_t) size * size * (size / 2 + 1) * sizeof(fftw_complex));
+    w = fftw_malloc(count * sizeof(real_t));
+    lock_planner();
+    fftw_plan_with_nthreads(1);
+    plan = fftw_plan_dft_c2r_3d(size, size, size, k, w, FFTW_ESTIMATE);
+    unlock_planner();
+    crop_fourier(spectrum, grid_max, 0, k, size, (size - 1) / 2, 1);
+    fftw_execute(plan);
+    for (voxel = 0; voxel < count; voxel++){
+      w[voxel] *= scale;
+    }
+    lock_planner();
+    fftw_destroy_plan(plan);
+    unlock_planner();
+    fftw_free(k);
+    weights[size] = w;
+  }
+  w = weights[size];
+  pthread_mutex_unlock(&weights_lock);
+  return w;
+}
+
+void crop_fourier(fftw_complex *in, int32_t full, int8_t stored, fftw_complex *out, int32_t size, int32_t radius, int32_t nthreads){
+  int32_t i;
+  sched work;
+  init_sched(&work, (int64_t) size * size, 1, nthreads, STATIC_SCHED);
+  crop_arg arg[nthreads];
+  // Set thread arguments
+  for (i = 0; i < nthreads; i++){
+    arg[i].in = in;
+    arg[i].out = out;
+    arg[i].full = full;
+    arg[i].size = size;
+    arg[i].radius = radius;
+    arg[i].stored = stored;
+    arg[i].work = &work;
+    arg[i].thread = i;
+  }
+  // Run threads on pool
+  run_pool((void*) crop_thread, arg, sizeof(arg[0]), nthreads);
+  return;
+}
+
+void crop_thread(crop_arg *arg){
+  int64_t row, src, dst, start = -1, end = -1;
+  int32_t half = arg->full / 2 + 1, size = arg->size / 2 + 1, k, j, i;
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for (row = start; row < end; row++){
+      // Frequencies of the coarse row as in the geometry tables
+      k = row / arg->size;
+      j = row % arg->size;
+      k = (k < size) ? k : k - arg->size;
+      j = (j < size) ? j : j - arg->size;
+      dst = row * size;
+      if (abs(k) > arg->radius || abs(j) > arg->radius){
+        memset(arg->out + dst, 0, size * sizeof(fftw_complex));
+        continue;
+      }
+      src = ((int64_t) ((k + arg->full) % arg->full) * arg->full + (j + arg->full) % arg->full) * half;
+      for (i = 0; i < size; i++){
+        if (i > arg->radius){
+          arg->out[dst + i] = 0.0;
+        } else {
+          arg->out[dst + i] = arg->stored ? get_coef(arg->in, src + i) : arg->in[src + i];
+        }
+      }
+    }
+  }
+  return;
+}
+
+// Allocate maps for the largest coarse box - plans are made per box as shells need them
+void alloc_coarse(shell *arg, int32_t fft_threads){
+  int64_t k_sz = (int64_t) grid_max * grid_max * (grid_max / 2 + 1);
+  int64_t r_sz = (int64_t) grid_max * grid_max * grid_max;
+  if (!grid_max || arg->crs){
+    return;
+  }
+  arg->crs = malloc(sizeof(coarse));
+  arg->crs->k1 = fftw_malloc(k_sz * sizeof(fftw_complex));
+  arg->crs->k2 = fftw_malloc(k_sz * sizeof(fftw_complex));
+  arg->crs->r1 = fftw_malloc(r_sz * sizeof(real_t));
+  arg->crs->r2 = fftw_malloc(r_sz * sizeof(real_t));
+  arg->crs->plan1 = calloc(grid_max + 1, sizeof(fftw_plan));
+  arg->crs->plan2 = calloc(grid_max + 1, sizeof(fftw_plan));
+  arg->crs->threads = fft_threads;
+  return;
+}
+
+// Filtered halves are zero beyond the band so cropping them loses nothing
+int32_t coarse_shell(shell *arg, uint32_t hi){
+  int32_t size = coarse_size(hi);
+  coarse *crs = arg->crs;
+  if (!crs || !size){
+    return 0;
+  }
+  if (!crs->plan1[size]){
+    // Coarse maps are private so plans may measure over them before cropping
+    lock_planner();
+    fftw_plan_with_nthreads(crs->threads);
+    crs->plan1[size] = fftw_plan_dft_c2r_3d(size, size, size, crs->k1, crs->r1, plan_effort());
+    crs->plan2[size] = fftw_plan_dft_c2r_3d(size, size, size, crs->k2, crs->r2, plan_effort());
+    unlock_planner();
+  }
+  crop_fourier(arg->ko1, arg->size, 1, crs->k1, size, band_radius(hi), arg->fourier);
+  crop_fourier(arg->ko2, arg->size, 1, crs->k2, size, band_radius(hi), arg->fourier);
+  fftw_execute(crs->plan1[size]);
+  fftw_execute(crs->plan2[size]);
+  return size;
+}
+
+// Each coarse voxel stands for (full / size)^3 voxels of the full box
+double coarse_norm(shell *arg){
+  int32_t size = arg->grid, nthreads = arg->real, i;
+  double scale = 1.0 / ((double) arg->size * arg->size * arg->size);
+  double share = scale * ((double) size * size * size);
+  real_t *mask = coarse_mask(size);
+  sched work;
+  init_sched(&work, (int64_t) size * size, 1, nthreads, STATIC_SCHED);
+  weigh_arg args[nthreads];
+  // Set thread arguments
+  for (i = 0; i < nthreads; i++){
+    args[i].mask = mask;
+    args[i].in1 = arg->crs->r1;
+    args[i].in2 = arg->crs->r2;
+    args[i].scale = scale;
+    args[i].size = size;
+    args[i].work = &work;
+    args[i].thread = i;
+  }
+  // Run threads on pool
+  run_pool((void*) coarse_noise_signal_thread, args, sizeof(args[0]), nthreads);
+  csum sums[2] = {{0.0, 0.0}, {0.0, 0.0}};
+  for (i = 0; i < nthreads; i++){
+    merge_sum(&sums[0], &args[i].noise);
+    merge_sum(&sums[1], &args[i].power);
+  }
+  // Mean over the voxels of the full box within the mask as in normalise
+  double noise = get_sum(&sums[0]) / (share * voxels);
+  double power = get_sum(&sums[1]) / (share * voxels);
+  double psnr = fabs(1.0 - noise / power);
+  arg->node->pwr = sqrt(power);
+  arg->node->max = psnr;
+  return psnr;
+}
+
+void coarse_noise_signal_thread(weigh_arg *arg){
+  int64_t r, start = -1, end = -1;
+  int32_t i;
+  double cur, m, in1, in2, noise, power;
+  real_t *row1, *row2, *mask;
+  csum sums[2] = {{0.0, 0.0}, {0.0, 0.0}};
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for (r = start; r < end; r++){
+      row1 = arg->in1 + r * arg->size;
+      row2 = arg->in2 + r * arg->size;
+      mask = arg->mask + r * arg->size;
+      // Rows are short so each is summed plainly then folded into compensated sums
+      noise = power = 0.0;
+      for (i = 0; i < arg->size; i++){
+        // Normalised as the full box transforms would be
+        in1 = row1[i] * arg->scale;
+        in2 = row2[i] * arg->scale;
+        m = mask[i];
+        cur = in1 - in2;
+        noise += m * cur * cur;
+        cur = in1 + in2;
+        power += m * cur * cur;
+      }
+      add_sum(&sums[0], noise);
+      add_sum(&sums[1], power);
+    }
+  }
+  // Write back once per thread
+  arg->noise = sums[0];
+  arg->power = sums[1];
+  return;
+}
+
+// Release coarse maps and plans of shell
+void free_coarse(shell *arg){
+  int32_t i;
+  if (!arg->crs){
+    return;
+  }
+  for (i = 0; i <= grid_max; i++){
+    if (arg->crs->plan1[i]){
+      fftw_destroy_plan(arg->crs->plan1[i]);
+      fftw_destroy_plan(arg->crs->plan2[i]);
+    }
+  }
+  fftw_free(arg->crs->k1);
+  fftw_free(arg->crs->k2);
+  fftw_free(arg->crs->r1);
+  fftw_free(arg->crs->r2);
+  free(arg->crs->plan1);
+  free(arg->crs->plan2);
+  free(arg->crs);
+  arg->crs = NULL;
+  return;
+}
+
+// Release the mask spectrum and weights
+void free_coarse_masks(void){
+  int32_t i;
+  if (!weights){
+    return;
+  }
+  for (i = 0; i <= grid_max; i++){
+    fftw_free(weights[i]);
+  }
+  free(weights);
+  fftw_free(spectrum);
+  weights = NULL;
+  spectrum = NULL;
+  grid_max = 0;
+  return;
+}
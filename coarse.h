@@ -0,0 +1,78 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Inclusions
+#include <stdio.h>
+#include <signal.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <complex.h>
+#include <fftw3.h>
+
+// Coarse boxes may hold at most this fraction of the voxels of the full box
+#define COARSE_SHARE 2
+
+// Crop thread arguments structure
+typedef struct{
+  fftw_complex   *in;
+  fftw_complex  *out;
+  int32_t      full;
+  int32_t      size;
+  int32_t    radius;
+  int8_t     stored;
+  sched       *work;
+  int32_t    thread;
+} CACHE_ALIGN crop_arg;
+
+// Coarse noise and signal power thread arguments structure
+typedef struct{
+  real_t      *mask;
+  real_t       *in1;
+  real_t       *in2;
+  double      scale;
+  csum        noise;
+  csum        power;
+  int32_t      size;
+  sched       *work;
+  int32_t    thread;
+} CACHE_ALIGN weigh_arg;
+
+int32_t fft_size(int32_t n);
+// Smallest box from n with no prime factor above 7
+
+real_t *coarse_mask(int32_t size);
+// Mask weights band limited to the coarse box - made on first use
+
+void crop_fourier(fftw_complex *in, int32_t full, int8_t stored, fftw_complex *out, int32_t size, int32_t radius, int32_t nthreads);
+// Copy coefficients within radius along each axis into a smaller half transform
+// In is in the storage layout if stored is set - out is always interleaved
+
+void crop_thread(crop_arg *arg);
+// Crop rows of the half transform
+// pthread function
+
+void coarse_noise_signal_thread(weigh_arg *arg);
+// Calculate mask weighted noise and signal power
+// pthread function
@@ -1 +1,11 @@
-gcc -O3 *.c -lm -pthread -lfftw3 -lfftw3_threads -std=c99 -o sidesplitter
+# Run with "single" to build against single precision FFTW (fftw3f)
+if [ "$1" = "single" ]; then
+  defs="-DSINGLE_PRECISION"; libs="-lfftw3f -lfftw3f_threads"; prefix=fftwf
+else
+  defs=""; libs="-lfftw3 -lfftw3_threads"; prefix=fftw
+fi
+# FFTW 3.3.9+ can run its threads on our worker pool
+if printf '#include <fftw3.h>\nint main(void){ %s_threads_set_callback(0, 0); return 0; }\n' $prefix | gcc -x c - $libs -lm -pthread -o /dev/null 2>/dev/null; then
+  defs="$defs -DHAVE_FFTW_THREADS_CALLBACK"
+fi
+gcc -O3 *.c -lm -pthread $libs -std=c99 $defs -o sidesplitter
@@ -24,84 +24,82 @@
 
 // Add FFT in to FFT out
 void add_fft(fftw_complex *in, fftw_complex *out, int32_t full, int32_t nthreads){
-  int32_t size = full * full * (full / 2 + 1), i;
-  pthread_t threads[nthreads];
+  int32_t size = full / 2 + 1, i;
+  sched work;
+  init_sched(&work, full * full, 1, nthreads, STATIC_SCHED);
   add_fft_arg arg[nthreads];
-  // Start threads
+  // Set thread arguments
   for (i = 0; i < nthreads; i++){
     arg[i].in = in;
     arg[i].out = out;
     arg[i].size = size;
-    arg[i].step = nthreads;
+    arg[i].work = &work;
     arg[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) add_fft_thread, &arg[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
-  }
-  // Join threads
-  for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
-    }
   }
+  // Run threads on pool
+  run_pool((void*) add_fft_thread, arg, sizeof(arg[0]), nthreads);
   return;
 }
 
 void add_fft_thread(add_fft_arg *arg){
-  for(int32_t index = arg->thread; index < arg->size; index += arg->step){
-    arg->out[index] += arg->in[index];
+  int64_t start = -1, end = -1;
+  // Blocks are whole rows of the half transform
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    add_row(arg->in, arg->out, start * arg->size, (end - start) * arg->size);
   }
   return;
 }
 
 // Calculate FSC over map
 double calc_fsc(fftw_complex *half1, fftw_complex *half2, int32_t full, int32_t nthreads){
-  int32_t size = full * full * (full / 2 + 1), i;
-  pthread_t threads[nthreads];
+  return calc_fsc_band(half1, half2, 0, UINT32_MAX, full, nthreads);
+}
+
+// Calculate FSC over coefficients with squared radius in [lo, hi]
+double calc_fsc_band(fftw_complex *half1, fftw_complex *half2, uint32_t lo, uint32_t hi, int32_t full, int32_t nthreads){
+  int32_t size = full / 2 + 1, i;
+  geom *geo = get_geometry(full, nthreads);
+  sched work;
+  init_sched(&work, full * full, 1, nthreads, STATIC_SCHED);
   calc_fsc_arg arg[nthreads];
-  // Start threads
+  // Set thread arguments
   for (i = 0; i < nthreads; i++){
     arg[i].half1 = half1;
     arg[i].half2 = half2;
-    arg[i].numerator = 0.0;
-    arg[i].denomin_2 = 0.0;
-    arg[i].denomin_1 = 0.0;
+    arg[i].geo = geo;
+    arg[i].lo = lo;
+    arg[i].hi = hi;
     arg[i].size = size;
-    arg[i].step = nthreads;
+    arg[i].work = &work;
     arg[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) calc_fsc_thread, &arg[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
   }
-  long double numerator = 0.0;
-  long double denomin_1 = 0.0;
-  long double denomin_2 = 0.0;
-  // Join threads
+  // Run threads on pool
+  run_pool((void*) calc_fsc_thread, arg, sizeof(arg[0]), nthreads);
+  csum sums[3] = {{0.0, 0.0}, {0.0, 0.0}, {0.0, 0.0}};
+  // Merge thread results
   for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
-    }
-    numerator += arg[i].numerator;
-    denomin_1 += arg[i].denomin_1;
-    denomin_2 += arg[i].denomin_2;
+    merge_sum(&sums[0], &arg[i].sums[0]);
+    merge_sum(&sums[1], &arg[i].sums[1]);
+    merge_sum(&sums[2], &arg[i].sums[2]);
   }
-  return (double) (numerator / sqrtl(fabsl(denomin_1 * denomin_2)));
+  return get_sum(&sums[0]) / sqrt(fabs(get_sum(&sums[1]) * get_sum(&sums[2])));
 }
 
 void calc_fsc_thread(calc_fsc_arg *arg){
-  for(int32_t index = arg->thread; index < arg->size; index += arg->step){
-    arg->numerator += creal(arg->half1[index] * conj(arg->half2[index]));
-    arg->denomin_1 += creal(arg->half1[index] * conj(arg->half1[index]));
-    arg->denomin_2 += creal(arg->half2[index] * conj(arg->half2[index]));
+  csum sums[3] = {{0.0, 0.0}, {0.0, 0.0}, {0.0, 0.0}};
+  int64_t index, row, start = -1, end = -1;
+  int32_t first, last;
+  // Blocks are whole rows of the half transform
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for(row = start; row < end; row++){
+      // Only the annulus within the band contributes
+      row_band(arg->geo, row, arg->lo, arg->hi, &first, &last);
+      index = row * arg->size + first;
+      corr_row(arg->half1, arg->half2, index, last - first, sums);
+    }
   }
+  // Write back once per thread
+  memcpy(arg->sums, sums, sizeof(sums));
   return;
 }
 
@@ -109,163 +107,334 @@ void calc_fsc_thread(calc_fsc_arg *arg){
 void bandpass_filter(fftw_complex *in, fftw_complex *out, list *node, int32_t full, int32_t nthreads){
   double hires = node->res + node->stp;
   double lores = node->res;
-  hires = hires * hires;
-  lores = lores * lores;
-  double dim = (double) full;
+  filter *table = get_filter(full, hires * hires, lores * lores);
+  apply_filter(in, out, table, full, nthreads);
+  put_filter(table);
+  return;
+}
+
+// Butterworth lowpass from in to out
+void lowpass_filter(fftw_complex *in, fftw_complex *out, list *node, int32_t full, int32_t nthreads){
+  double hires = node->res + node->stp;
+  filter *table = get_filter(full, hires * hires, -1.0);
+  apply_filter(in, out, table, full, nthreads);
+  put_filter(table);
+  return;
+}
+
+// Multiply in by filter table gathered by squared radius
+void apply_filter(fftw_complex *in, fftw_complex *out, filter *table, int32_t full, int32_t nthreads){
+  geom *geo = get_geometry(full, nthreads);
   int32_t size = (full / 2) + 1, i;
-  int32_t full_size = full * size;
-  pthread_t threads[nthreads];
+  sched work;
+  init_sched(&work, full * full, 1, nthreads, STATIC_SCHED);
   filter_arg arg[nthreads];
-  // Start threads
+  // Set thread arguments
   for (i = 0; i < nthreads; i++){
     arg[i].in = in;
     arg[i].out = out;
-    arg[i].hires = hires;
-    arg[i].lores = lores;
-    arg[i].dim = dim;
-    arg[i].full_size = full_size;
-    arg[i].full = full;
+    arg[i].table = table->table;
+    arg[i].lo = table->lo;
+    arg[i].hi = table->hi;
+    arg[i].geo = geo;
     arg[i].size = size;
-    arg[i].step = nthreads;
+    arg[i].work = &work;
     arg[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) bandpass_filter_thread, &arg[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
+  }
+  // Run threads on pool
+  run_pool((void*) filter_thread, arg, sizeof(arg[0]), nthreads);
+  return;
+}
+
+void filter_thread(filter_arg *arg){
+  int64_t row, start = -1, end = -1;
+  int32_t first, last;
+  // Blocks are whole rows of the half transform
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for(row = start; row < end; row++){
+      row_band(arg->geo, row, arg->lo, arg->hi, &first, &last);
+      // Outside the annulus the filter weight is negligible
+      zero_row(arg->out, row * arg->size, first);
+      zero_row(arg->out, row * arg->size + last, arg->size - last);
+      scale_row(arg->in, arg->out, arg->table, arg->geo->r2, row * arg->size + first, last - first);
     }
   }
-  // Join threads
+  return;
+}
+
+// Bandpass both halves in one sweep - returns FSC over the band
+double bandpass_pair(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, list *node, int32_t full, int32_t nthreads){
+  double hires = node->res + node->stp;
+  double lores = node->res;
+  filter *table = get_filter(full, hires * hires, lores * lores);
+  double fsc = filter_pair(in1, in2, out1, out2, table, 1, full, nthreads);
+  put_filter(table);
+  return fsc;
+}
+
+// Lowpass both halves in one sweep - returns FSC if corr is set
+double lowpass_pair(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, list *node, int8_t corr, int32_t full, int32_t nthreads){
+  double hires = node->res + node->stp;
+  filter *table = get_filter(full, hires * hires, -1.0);
+  double fsc = filter_pair(in1, in2, out1, out2, table, corr, full, nthreads);
+  put_filter(table);
+  return fsc;
+}
+
+// Filter both halves and accumulate their correlation as it streams past
+double filter_pair(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, filter *table, int8_t corr, int32_t full, int32_t nthreads){
+  geom *geo = get_geometry(full, nthreads);
+  int32_t size = (full / 2) + 1, i;
+  sched work;
+  init_sched(&work, full * full, 1, nthreads, STATIC_SCHED);
+  pair_arg arg[nthreads];
+  // Set thread arguments
+  for (i = 0; i < nthreads; i++){
+    arg[i].in1 = in1;
+    arg[i].in2 = in2;
+    arg[i].out1 = out1;
+    arg[i].out2 = out2;
+    arg[i].table = table->table;
+    arg[i].geo = geo;
+    arg[i].lo = table->lo;
+    arg[i].hi = table->hi;
+    arg[i].corr = corr;
+    arg[i].size = size;
+    arg[i].work = &work;
+    arg[i].thread = i;
+  }
+  // Run threads on pool
+  run_pool((void*) filter_pair_thread, arg, sizeof(arg[0]), nthreads);
+  if (!corr){
+    return 0.0;
+  }
+  csum sums[3] = {{0.0, 0.0}, {0.0, 0.0}, {0.0, 0.0}};
+  // Merge thread results
   for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
+    merge_sum(&sums[0], &arg[i].sums[0]);
+    merge_sum(&sums[1], &arg[i].sums[1]);
+    merge_sum(&sums[2], &arg[i].sums[2]);
+  }
+  return get_sum(&sums[0]) / sqrt(fabs(get_sum(&sums[1]) * get_sum(&sums[2])));
+}
+
+void filter_pair_thread(pair_arg *arg){
+  csum sums[3] = {{0.0, 0.0}, {0.0, 0.0}, {0.0, 0.0}};
+  int64_t row, start = -1, end = -1;
+  int32_t first, last;
+  // Blocks are whole rows of the half transform
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for(row = start; row < end; row++){
+      row_band(arg->geo, row, arg->lo, arg->hi, &first, &last);
+      // Outside the annulus the filter weight is negligible
+      zero_row(arg->out1, row * arg->size, first);
+      zero_row(arg->out2, row * arg->size, first);
+      zero_row(arg->out1, row * arg->size + last, arg->size - last);
+      zero_row(arg->out2, row * arg->size + last, arg->size - last);
+      pair_row(arg->in1, arg->in2, arg->out1, arg->out2, arg->table, arg->geo->r2, row * arg->size + first, last - first, arg->corr ? sums : NULL);
     }
   }
+  // Write back once per thread
+  memcpy(arg->sums, sums, sizeof(sums));
   return;
 }
 
-void bandpass_filter_thread(filter_arg* arg){
-  double norms, kd, jd, id;
-  int32_t index;
-  for(int _k = 0, k = 0; _k < arg->full; _k++, k = (_k < arg->size) ? _k : _k - arg->full){
-    kd = ((double) k) / arg->dim;
-    for(int _j = 0, j = 0; _j < arg->full; _j++, j = (_j < arg->size) ? _j : _j - arg->full){
-      jd = ((double) j) / arg->dim;
-      for(int _i = arg->thread, i = arg->thread; _i < arg->size; _i += arg->step, i = _i){
-        id = ((double) i) / arg->dim;
-        norms = kd * kd + jd * jd + id * id;
-        index = _k * arg->full_size + _j * arg->size + _i;
-        arg->out[index] = arg->in[index] * (sqrt(1.0 / (1.0 + pow((norms / arg->hires), 8.0))) - sqrt(1.0 / (1.0 + pow((norms / arg->lores), 8.0))));
+// Filter both halves by count tables while each input row is still in cache
+void filter_batch(fftw_complex *in1, fftw_complex *in2, fftw_complex **out1, fftw_complex **out2, filter **table, int32_t count, int32_t full, int32_t nthreads){
+  geom *geo = get_geometry(full, nthreads);
+  int32_t size = (full / 2) + 1, i;
+  sched work;
+  init_sched(&work, full * full, 1, nthreads, STATIC_SCHED);
+  batch_arg arg[nthreads];
+  // Set thread arguments
+  for (i = 0; i < nthreads; i++){
+    arg[i].in1 = in1;
+    arg[i].in2 = in2;
+    arg[i].out1 = out1;
+    arg[i].out2 = out2;
+    arg[i].table = table;
+    arg[i].geo = geo;
+    arg[i].count = count;
+    arg[i].size = size;
+    arg[i].work = &work;
+    arg[i].thread = i;
+  }
+  // Run threads on pool
+  run_pool((void*) filter_batch_thread, arg, sizeof(arg[0]), nthreads);
+  return;
+}
+
+void filter_batch_thread(batch_arg *arg){
+  int64_t row, start = -1, end = -1;
+  int32_t first, last, k;
+  filter *table;
+  // Blocks are whole rows of the half transform
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for(row = start; row < end; row++){
+      // Later outputs find the input row in cache
+      for (k = 0; k < arg->count; k++){
+        table = arg->table[k];
+        row_band(arg->geo, row, table->lo, table->hi, &first, &last);
+        zero_row(arg->out1[k], row * arg->size, first);
+        zero_row(arg->out2[k], row * arg->size, first);
+        zero_row(arg->out1[k], row * arg->size + last, arg->size - last);
+        zero_row(arg->out2[k], row * arg->size + last, arg->size - last);
+        pair_row(arg->in1, arg->in2, arg->out1[k], arg->out2[k], table->table, arg->geo->r2, row * arg->size + first, last - first, NULL);
       }
     }
   }
   return;
 }
 
-// Butterworth lowpass from in to out
-void lowpass_filter(fftw_complex *in, fftw_complex *out, list *node, int32_t full, int32_t nthreads){
-  double hires = node->res + node->stp;
-  hires = hires * hires;
-  double dim = (double) full;
-  int32_t size = (full / 2) + 1, i;
-  int32_t full_size = full * size;
-  pthread_t threads[nthreads];
-  filter_arg arg[nthreads];
-  // Start threads
+// Gather cross and power spectra of both halves by squared radius
+profile *get_profile(fftw_complex *half1, fftw_complex *half2, int8_t whole, int32_t full, int32_t nthreads){
+  geom *geo = get_geometry(full, nthreads);
+  int32_t size = (full / 2) + 1, half = full / 2, i, j;
+  profile *prof = malloc(sizeof(profile));
+  prof->radii = 3 * half * half + 1;
+  prof->nom = calloc(prof->radii, sizeof(csum));
+  prof->dn1 = calloc(prof->radii, sizeof(csum));
+  prof->dn2 = calloc(prof->radii, sizeof(csum));
+  prof->dif = whole ? calloc(prof->radii, sizeof(csum)) : NULL;
+  prof->sum = whole ? calloc(prof->radii, sizeof(csum)) : NULL;
+  sched work;
+  init_sched(&work, full * full, 1, nthreads, STATIC_SCHED);
+  prof_arg arg[nthreads];
+  // Set thread arguments
   for (i = 0; i < nthreads; i++){
-    arg[i].in = in;
-    arg[i].out = out;
-    arg[i].hires = hires;
-    arg[i].dim = dim;
-    arg[i].full_size = full_size;
+    arg[i].in1 = half1;
+    arg[i].in2 = half2;
+    arg[i].nom = calloc(prof->radii, sizeof(csum));
+    arg[i].dn1 = calloc(prof->radii, sizeof(csum));
+    arg[i].dn2 = calloc(prof->radii, sizeof(csum));
+    arg[i].dif = whole ? calloc(prof->radii, sizeof(csum)) : NULL;
+    arg[i].sum = whole ? calloc(prof->radii, sizeof(csum)) : NULL;
+    arg[i].geo = geo;
     arg[i].full = full;
     arg[i].size = size;
-    arg[i].step = nthreads;
+    arg[i].work = &work;
     arg[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) lowpass_filter_thread, &arg[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
   }
-  // Join threads
+  // Run threads on pool
+  run_pool((void*) get_profile_thread, arg, sizeof(arg[0]), nthreads);
+  // Merge thread results
   for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
+    for (j = 0; j < prof->radii; j++){
+      merge_sum(&prof->nom[j], &arg[i].nom[j]);
+      merge_sum(&prof->dn1[j], &arg[i].dn1[j]);
+      merge_sum(&prof->dn2[j], &arg[i].dn2[j]);
+      if (whole){
+        merge_sum(&prof->dif[j], &arg[i].dif[j]);
+        merge_sum(&prof->sum[j], &arg[i].sum[j]);
+      }
     }
+    free(arg[i].nom);
+    free(arg[i].dn1);
+    free(arg[i].dn2);
+    free(arg[i].dif);
+    free(arg[i].sum);
   }
-  return;
+  return prof;
 }
 
-void lowpass_filter_thread(filter_arg *arg){
-  double norms, kd, jd, id;
-  int32_t index;
-  for(int _k = 0, k = 0; _k < arg->full; _k++, k = (_k < arg->size) ? _k : _k - arg->full){
-    kd = ((double) k) / arg->dim;
-    for(int _j = 0, j = 0; _j < arg->full; _j++, j = (_j < arg->size) ? _j : _j - arg->full){
-      jd = ((double) j) / arg->dim;
-      for(int _i = arg->thread, i = arg->thread; _i < arg->size; _i += arg->step, i = _i){
-        id = ((double) i) / arg->dim;
-        norms = kd * kd + jd * jd + id * id;
-        index = _k * arg->full_size + _j * arg->size + _i;
-        arg->out[index] = arg->in[index] * sqrt(1.0 / (1.0 + pow((norms / arg->hires), 8.0)));
+void get_profile_thread(prof_arg *arg){
+  int64_t index, row, start = -1, end = -1;
+  fftw_complex f1, f2;
+  uint32_t r2;
+  int32_t i;
+  double m;
+  // Blocks are whole rows of the half transform
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for(row = start; row < end; row++){
+      for(i = 0; i < arg->size; i++){
+        index = row * arg->size + i;
+        r2 = arg->geo->r2[index];
+        f1 = get_coef(arg->in1, index);
+        f2 = get_coef(arg->in2, index);
+        add_sum(&arg->nom[r2], creal(f1 * conj(f2)));
+        add_sum(&arg->dn1[r2], creal(f1 * conj(f1)));
+        add_sum(&arg->dn2[r2], creal(f2 * conj(f2)));
+        if (arg->dif){
+          // Columns other than zero and Nyquist stand for their Friedel mates too
+          m = (i == 0 || 2 * i == arg->full) ? 1.0 : 2.0;
+          add_sum(&arg->dif[r2], m * creal((f1 - f2) * conj(f1 - f2)));
+          add_sum(&arg->sum[r2], m * creal((f1 + f2) * conj(f1 + f2)));
+        }
       }
     }
   }
   return;
 }
 
+// FSC after filtering by table - the filter is radial so this is a sum over radii
+double profile_fsc(profile *prof, filter *table){
+  csum sums[3] = {{0.0, 0.0}, {0.0, 0.0}, {0.0, 0.0}};
+  uint32_t r2, hi = (table->hi < (uint32_t) prof->radii) ? table->hi : (uint32_t) (prof->radii - 1);
+  double w2;
+  for (r2 = table->lo; r2 <= hi; r2++){
+    w2 = table->table[r2] * table->table[r2];
+    add_sum(&sums[0], w2 * get_sum(&prof->nom[r2]));
+    add_sum(&sums[1], w2 * get_sum(&prof->dn1[r2]));
+    add_sum(&sums[2], w2 * get_sum(&prof->dn2[r2]));
+  }
+  return get_sum(&sums[0]) / sqrt(fabs(get_sum(&sums[1]) * get_sum(&sums[2])));
+}
+
+void free_profile(profile *prof){
+  if (prof){
+    free(prof->nom);
+    free(prof->dn1);
+    free(prof->dn2);
+    free(prof->dif);
+    free(prof->sum);
+    free(prof);
+  }
+  return;
+}
+
 // Calculate spectrum over map
-double get_spectrum(fftw_complex *half1, fftw_complex *half2, long double *spec1, long double *spec2, int32_t full, int32_t nthreads){
+double get_spectrum(fftw_complex *half1, fftw_complex *half2, double *spec1, double *spec2, int32_t full, int32_t nthreads){
   double fsc, crf, cut = 0.0;
-  double dim = (double) full;
+  geom *geo = get_geometry(full, nthreads);
   int32_t size = (full / 2) + 1, i, j;
   int32_t full_size = full * size;
   int32_t *n = calloc(full, sizeof(int32_t));
-  long double *nom = calloc(full, sizeof(long double));
-  long double *dn1 = calloc(full, sizeof(long double));
-  long double *dn2 = calloc(full, sizeof(long double));
-  pthread_t threads[nthreads];
+  csum *out1 = calloc(full, sizeof(csum));
+  csum *out2 = calloc(full, sizeof(csum));
+  csum *nom = calloc(full, sizeof(csum));
+  csum *dn1 = calloc(full, sizeof(csum));
+  csum *dn2 = calloc(full, sizeof(csum));
+  sched work;
+  init_sched(&work, full * full, 1, nthreads, STATIC_SCHED);
   spec_arg arg[nthreads];
-  // Start threads
+  // Set thread arguments
   for (i = 0; i < nthreads; i++){
     arg[i].in1 = half1;
     arg[i].in2 = half2;
-    arg[i].out1 = calloc(full, sizeof(long double));
-    arg[i].out2 = calloc(full, sizeof(long double));
+    arg[i].out1 = calloc(full, sizeof(csum));
+    arg[i].out2 = calloc(full, sizeof(csum));
     arg[i].n = calloc(full, sizeof(int32_t));
-    arg[i].nom = calloc(full, sizeof(long double));
-    arg[i].dn1 = calloc(full, sizeof(long double));
-    arg[i].dn2 = calloc(full, sizeof(long double));
-    arg[i].dim = dim;
+    arg[i].nom = calloc(full, sizeof(csum));
+    arg[i].dn1 = calloc(full, sizeof(csum));
+    arg[i].dn2 = calloc(full, sizeof(csum));
+    arg[i].geo = geo;
     arg[i].full_size = full_size;
     arg[i].full = full;
     arg[i].size = size;
-    arg[i].step = nthreads;
+    arg[i].work = &work;
     arg[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) get_spec_thread, &arg[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
   }
-  // Join threads
+  // Run threads on pool
+  run_pool((void*) get_spec_thread, arg, sizeof(arg[0]), nthreads);
+  // Merge thread results
   for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
-    }
     for (j = 0; j < full; j++){
       n[j] += arg[i].n[j];
-      spec1[j] += arg[i].out1[j];
-      spec2[j] += arg[i].out2[j];
-      nom[j] += arg[i].nom[j];
-      dn1[j] += arg[i].dn1[j];
-      dn2[j] += arg[i].dn2[j];
+      merge_sum(&out1[j], &arg[i].out1[j]);
+      merge_sum(&out2[j], &arg[i].out2[j]);
+      merge_sum(&nom[j], &arg[i].nom[j]);
+      merge_sum(&dn1[j], &arg[i].dn1[j]);
+      merge_sum(&dn2[j], &arg[i].dn2[j]);
     }
     free(arg[i].n);
     free(arg[i].out1);
@@ -278,17 +447,22 @@ double get_spectrum(fftw_complex *half1, fftw_complex *half2, long double *spec1
     if (n[i] == 0){
       continue;
     }
-    fsc = fabsl((fabsl(nom[i]) / sqrtl(fabsl(dn1[i]) * fabsl(dn2[i]))));
+    fsc = fabs(get_sum(&nom[i]) / sqrt(fabs(get_sum(&dn1[i]) * get_sum(&dn2[i]))));
     crf = sqrt((2.0 * fsc) / (1.0 + fsc));
-    spec1[i] = crf * (spec1[i] / (double) n[i]);
-    spec2[i] = crf * (spec2[i] / (double) n[i]);
+    spec1[i] = crf * (get_sum(&out1[i]) / (double) n[i]);
+    spec2[i] = crf * (get_sum(&out2[i]) / (double) n[i]);
     if ((cut == 0.0) && (fsc < 0.1)){
       cut = ((double) i) / (full * 2.0);
     }
   }
   free(n);
-  spec1[0] = creal(half1[0]);
-  spec2[0] = creal(half2[0]);
+  free(out1);
+  free(out2);
+  free(nom);
+  free(dn1);
+  free(dn2);
+  spec1[0] = creal(get_coef(half1, 0));
+  spec2[0] = creal(get_coef(half2, 0));
   if (cut == 0.0){
     cut = 0.475;
   }
@@ -296,138 +470,92 @@ double get_spectrum(fftw_complex *half1, fftw_complex *half2, long double *spec1
 }
 
 void get_spec_thread(spec_arg *arg){
-  double kd, jd, id;
-  int32_t index, norms;
-  for(int _k = 0, k = 0; _k < arg->full; _k++, k = (_k < arg->size) ? _k : _k - arg->full){
-    kd = (double) k;
-    for(int _j = 0, j = 0; _j < arg->full; _j++, j = (_j < arg->size) ? _j : _j - arg->full){
-      jd = (double) j;
-      for(int _i = arg->thread, i = arg->thread; _i < arg->size; _i += arg->step, i = _i){
-        id = (double) i;
-        norms = (int32_t) round(sqrt(fabs(kd * kd + jd * jd + id * id)) * 2.0);
-	if (norms >= arg->full){
-	  continue;
-	}
-        index = _k * arg->full_size + _j * arg->size + _i;
-        arg->out1[norms] += sqrtl(fabsl(creal(arg->in1[index] * conj(arg->in1[index]))));
-	arg->out2[norms] += sqrtl(fabsl(creal(arg->in2[index] * conj(arg->in2[index]))));
-	if (arg->nom && arg->dn1 && arg->dn2){
-	  arg->nom[norms] += creal((arg->in1[index]) * conj(arg->in2[index]));
-	  arg->dn1[norms] += creal((arg->in1[index]) * conj(arg->in1[index]));
-	  arg->dn2[norms] += creal((arg->in2[index]) * conj(arg->in2[index]));
-	}
-	arg->n[norms]++;
-      }
+  int32_t first, last;
+  int64_t index, row, start = -1, end = -1;
+  // Blocks are whole rows of the half transform
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for(row = start; row < end; row++){
+      // Corners beyond the last full shell are not counted
+      row_band(arg->geo, row, 0, arg->geo->edge, &first, &last);
+      index = row * arg->size + first;
+      spectra_row(arg->in1, arg->in2, arg->geo->shell, index, last - first, arg->out1, arg->out2, arg->nom, arg->dn1, arg->dn2, arg->n);
     }
   }
   return;
 }
 
 // Apply spectrum over map
-void apply_spectrum(fftw_complex *half1, fftw_complex *half2, long double *spec1, long double *spec2, double maxres, int32_t full, int32_t nthreads){
-  double dim = (double) full;
+void apply_spectrum(fftw_complex *half1, fftw_complex *half2, double *spec1, double *spec2, double maxres, int32_t full, int32_t nthreads){
+  geom *geo = get_geometry(full, nthreads);
   int32_t size = (full / 2) + 1, i, j;
   int32_t full_size = full * size;
   int32_t *n = calloc(full, sizeof(int32_t));
-  long double *cor1 = calloc(full, sizeof(long double));
-  long double *cor2 = calloc(full, sizeof(long double));
-  pthread_t threads[nthreads];
+  csum *cor1 = calloc(full, sizeof(csum));
+  csum *cor2 = calloc(full, sizeof(csum));
+  sched work;
+  init_sched(&work, full * full, 1, nthreads, STATIC_SCHED);
   spec_arg arg[nthreads];
-  // Start threads
+  // Set thread arguments
   for (i = 0; i < nthreads; i++){
     arg[i].in1 = half1;
     arg[i].in2 = half2;
-    arg[i].out1 = calloc(full, sizeof(long double));
-    arg[i].out2 = calloc(full, sizeof(long double));
+    arg[i].out1 = calloc(full, sizeof(csum));
+    arg[i].out2 = calloc(full, sizeof(csum));
     arg[i].n = calloc(full, sizeof(int32_t));
     arg[i].nom = NULL;
     arg[i].dn1 = NULL;
     arg[i].dn2 = NULL;
-    arg[i].dim = dim;
+    arg[i].geo = geo;
     arg[i].full_size = full_size;
     arg[i].full = full;
     arg[i].size = size;
-    arg[i].step = nthreads;
+    arg[i].work = &work;
     arg[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) get_spec_thread, &arg[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
   }
-  // Join threads
+  // Run threads on pool
+  run_pool((void*) get_spec_thread, arg, sizeof(arg[0]), nthreads);
+  // Merge thread results
   for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
-    }
     for (j = 0; j < full; j++){
       n[j] += arg[i].n[j];
-      cor1[j] += arg[i].out1[j];
-      cor2[j] += arg[i].out2[j];
+      merge_sum(&cor1[j], &arg[i].out1[j]);
+      merge_sum(&cor2[j], &arg[i].out2[j]);
     }
     free(arg[i].n);
     free(arg[i].out1);
     free(arg[i].out2);
   }
-  // Normalise
+  // Normalise into weights by shell - shells past the cut or the edge are zeroed
   int32_t cut = (int32_t) (maxres * full * 2.0);
-  for (i = 0; i < full; i++){
-    if (i < cut){
-      cor1[i] = spec1[i] / (cor1[i] / (long double) n[i]);
-      cor2[i] = spec2[i] / (cor2[i] / (long double) n[i]);
-    } else {
-      cor1[i] = 0.0;
-      cor2[i] = 0.0;
-    }
+  double *w1 = calloc(full + 1, sizeof(double));
+  double *w2 = calloc(full + 1, sizeof(double));
+  for (i = 0; i < full && i < cut; i++){
+    w1[i] = spec1[i] / (get_sum(&cor1[i]) / (double) n[i]);
+    w2[i] = spec2[i] / (get_sum(&cor2[i]) / (double) n[i]);
   }
-  // Start threads
+  // Reset partition and set thread arguments
+  init_sched(&work, full * full, 1, nthreads, STATIC_SCHED);
   for (i = 0; i < nthreads; i++){
-    arg[i].out1 = cor1;
-    arg[i].out2 = cor2;
-    if (pthread_create(&threads[i], NULL, (void*) apply_spec_thread, &arg[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
+    arg[i].w1 = w1;
+    arg[i].w2 = w2;
   }
-  // Join threads
-  for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
-    }
-  }
-  half1[0] = spec1[0] + 0.0J;
-  half2[0] = spec2[0] + 0.0J;
+  // Run threads on pool
+  run_pool((void*) apply_spec_thread, arg, sizeof(arg[0]), nthreads);
+  set_coef(half1, 0, spec1[0] + 0.0J);
+  set_coef(half2, 0, spec2[0] + 0.0J);
   free(cor1);
   free(cor2);
+  free(w1);
+  free(w2);
   free(n);
   return;
 }
 
 void apply_spec_thread(spec_arg *arg){
-  double kd, jd, id;
-  int32_t index, norms;
-  for(int _k = 0, k = 0; _k < arg->full; _k++, k = (_k < arg->size) ? _k : _k - arg->full){
-    kd = (double) k;
-    for(int _j = 0, j = 0; _j < arg->full; _j++, j = (_j < arg->size) ? _j : _j - arg->full){
-      jd = (double) j;
-      for(int _i = arg->thread, i = arg->thread; _i < arg->size; _i += arg->step, i = _i){
-        id = (double) i;
-        norms = (int32_t) round(sqrt(fabs(kd * kd + jd * jd + id * id)) * 2.0);
-        index = _k * arg->full_size + _j * arg->size + _i;
-	if (norms >= arg->full){
-	  arg->in1[index] *= 0.0;
-	  arg->in2[index] *= 0.0;
-	  continue;
-	}
-        arg->in1[index] *= arg->out1[norms];
-	arg->in2[index] *= arg->out2[norms];
-      }
-    }
+  int64_t start = -1, end = -1;
+  // Blocks are whole rows of the half transform
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    shells_row(arg->in1, arg->in2, arg->w1, arg->w2, arg->geo->shell, start * arg->size, (end - start) * arg->size);
   }
   return;
 }
@@ -36,72 +36,127 @@ typedef struct {
   fftw_complex  *in;
   fftw_complex *out;
   int32_t      size;
-  int32_t      step;
+  sched       *work;
   int32_t    thread;
-} add_fft_arg;
+} CACHE_ALIGN add_fft_arg;
 
 // Calc FSC thread arguments structure
 typedef struct{
   fftw_complex   *half1;
   fftw_complex   *half2;
-  long double numerator;
-  long double denomin_1;
-  long double denomin_2;
+  csum          sums[3];
+  geom             *geo;
+  uint32_t           lo;
+  uint32_t           hi;
   int32_t          size;
-  int32_t          step;
+  sched           *work;
   int32_t        thread;
-} calc_fsc_arg;
+} CACHE_ALIGN calc_fsc_arg;
 
 // Filter map thread arguments structure
 typedef struct{
   fftw_complex  *in;
   fftw_complex *out;
-  double      hires;
-  double      lores;
-  double        dim;
-  int32_t full_size;
+  double     *table;
+  geom         *geo;
+  uint32_t       lo;
+  uint32_t       hi;
+  int32_t      size;
+  sched       *work;
+  int32_t    thread;
+} CACHE_ALIGN filter_arg;
+
+// Paired filter thread arguments structure
+typedef struct{
+  fftw_complex     *in1;
+  fftw_complex     *in2;
+  fftw_complex    *out1;
+  fftw_complex    *out2;
+  double         *table;
+  geom             *geo;
+  uint32_t           lo;
+  uint32_t           hi;
+  csum          sums[3];
+  int8_t           corr;
+  int32_t          size;
+  sched           *work;
+  int32_t        thread;
+} CACHE_ALIGN pair_arg;
+
+// Batched filter thread arguments structure
+typedef struct{
+  fftw_complex   *in1;
+  fftw_complex   *in2;
+  fftw_complex **out1;
+  fftw_complex **out2;
+  filter      **table;
+  geom           *geo;
+  int32_t       count;
+  int32_t        size;
+  sched         *work;
+  int32_t      thread;
+} CACHE_ALIGN batch_arg;
+
+// Radial profile thread arguments structure
+typedef struct{
+  fftw_complex *in1;
+  fftw_complex *in2;
+  csum         *nom;
+  csum         *dn1;
+  csum         *dn2;
+  csum         *dif;
+  csum         *sum;
+  geom         *geo;
   int32_t      full;
   int32_t      size;
-  int32_t      step;
+  sched       *work;
   int32_t    thread;
-} filter_arg;
+} CACHE_ALIGN prof_arg;
 
 // Spectrum thread arguments structure
 typedef struct{
   fftw_complex *in1;
   fftw_complex *in2;
-  long double *out1;
-  long double *out2;
-  long double  *nom;
-  long double  *dn1;
-  long double  *dn2;
+  csum        *out1;
+  csum        *out2;
+  csum         *nom;
+  csum         *dn1;
+  csum         *dn2;
+  double        *w1;
+  double        *w2;
   int32_t        *n;
-  double        dim;
+  geom         *geo;
   int32_t full_size;
   int32_t      full;
   int32_t      size;
-  int32_t      step;
+  sched       *work;
   int32_t    thread;
-} spec_arg;
+} CACHE_ALIGN spec_arg;
 
 void add_fft_thread(add_fft_arg *arg);
 // Add FFT in to out
 // pthread function
 
-void bandpass_filter_thread(filter_arg *arg);
-// Apply bandpass to in and writes to out
-// List node specifies resolutions
+void filter_thread(filter_arg *arg);
+// Multiply in by tabulated filter into out
 // pthread function
 
-void lowpass_filter_thread(filter_arg *arg);
-// Butterworth lowpass from in to out
-// List node specifies resolution
+void filter_pair_thread(pair_arg *arg);
+// Filter both halves and sum their correlation
+// pthread function
+
+void filter_batch_thread(batch_arg *arg);
+// Filter both halves by each table in turn
 // pthread function
 
 void calc_fsc_thread(calc_fsc_arg *arg);
 // Calculate FSC over map
 // pthread function
 
+void get_profile_thread(prof_arg *arg);
+// Gather spectra by squared radius
+// pthread function
+
 void get_spec_thread(spec_arg *arg);
 // Calculate spectrum over map
 // pthread function
@@ -0,0 +1,147 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Library header inclusion for linking
+#include "sidesplitter.h"
+#include "geometry.h"
+
+// Tables for the last box size - rebuilt only if it changes
+static geom *cache = NULL;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Return radius and shell tables for half transforms of full
+geom *get_geometry(int32_t full, int32_t nthreads){
+  int32_t i;
+  geom *geo;
+  pthread_mutex_lock(&cache_lock);
+  if (cache && cache->full == full){
+    geo = cache;
+    pthread_mutex_unlock(&cache_lock);
+    return geo;
+  }
+  if (cache){
+    free(cache->r2);
+    free(cache->shell);
+    free(cache);
+  }
+  geo = malloc(sizeof(geom));
+  geo->full = full;
+  geo->size = (full / 2) + 1;
+  geo->r2 = malloc((size_t) full * full * geo->size * sizeof(uint32_t));
+  geo->shell = malloc((size_t) full * full * geo->size * sizeof(uint16_t));
+  // Largest squared radius inside the last full shell
+  for (geo->edge = 0; (int32_t) round(sqrt((double) (geo->edge + 1)) * 2.0) < full; geo->edge++);
+  // First touch by the same rows as the kernels
+  sched work;
+  init_sched(&work, full * full, 1, nthreads, STATIC_SCHED);
+  geom_arg arg[nthreads];
+  for (i = 0; i < nthreads; i++){
+    arg[i].geo = geo;
+    arg[i].work = &work;
+    arg[i].thread = i;
+  }
+  // Run threads on pool
+  run_pool((void*) geometry_thread, arg, sizeof(arg[0]), nthreads);
+  cache = geo;
+  pthread_mutex_unlock(&cache_lock);
+  return geo;
+}
+
+// Column range of row whose squared radius lies in [lo, hi]
+void row_band(geom *geo, int64_t row, uint32_t lo, uint32_t hi, int32_t *first, int32_t *last){
+  // Radius of the first column is that of the row itself
+  int64_t kj2 = geo->r2[row * geo->size];
+  int64_t i;
+  *first = 0;
+  *last = 0;
+  if (kj2 > hi || lo > hi){
+    return;
+  }
+  i = (kj2 < lo) ? (int64_t) sqrt((double) (lo - kj2)) : 0;
+  while (i > 0 && kj2 + (i - 1) * (i - 1) >= lo){
+    i--;
+  }
+  while (kj2 + i * i < lo){
+    i++;
+  }
+  *first = (i < geo->size) ? (int32_t) i : geo->size;
+  i = (int64_t) sqrt((double) (hi - kj2));
+  while (kj2 + i * i > hi){
+    i--;
+  }
+  while (kj2 + (i + 1) * (i + 1) <= hi){
+    i++;
+  }
+  *last = (i + 1 < geo->size) ? (int32_t) (i + 1) : geo->size;
+  if (*last < *first){
+    *last = *first;
+  }
+  return;
+}
+
+// Largest whole radius within squared radius hi
+int32_t band_radius(uint32_t hi){
+  int32_t r = (int32_t) sqrt((double) hi);
+  while ((int64_t) r * r > hi){
+    r--;
+  }
+  while ((int64_t) (r + 1) * (r + 1) <= hi){
+    r++;
+  }
+  return r;
+}
+
+// Release cached tables
+void free_geometry(void){
+  pthread_mutex_lock(&cache_lock);
+  if (cache){
+    free(cache->r2);
+    free(cache->shell);
+    free(cache);
+    cache = NULL;
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return;
+}
+
+void geometry_thread(geom_arg *arg){
+  geom *geo = arg->geo;
+  int32_t _k, _j, k, j, i, shell;
+  uint32_t r2;
+  int64_t index, row, start = -1, end = -1;
+  // Blocks are whole rows of the half transform
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for(row = start; row < end; row++){
+      _k = row / geo->full;
+      _j = row % geo->full;
+      k = (_k < geo->size) ? _k : _k - geo->full;
+      j = (_j < geo->size) ? _j : _j - geo->full;
+      for(i = 0; i < geo->size; i++){
+        index = row * geo->size + i;
+        r2 = (uint32_t) (k * k + j * j + i * i);
+        // Shells past the box edge share the sentinel full
+        shell = (int32_t) round(sqrt((double) r2) * 2.0);
+        geo->r2[index] = r2;
+        geo->shell[index] = (uint16_t) ((shell < geo->full) ? shell : geo->full);
+      }
+    }
+  }
+  return;
+}
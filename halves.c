@@ -0,0 +1,350 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Library header inclusion for linking
+#include "sidesplitter.h"
+#include "halves.h"
+
+// Guru dimensions of a box - strides in reals for real maps and coefficients for half transforms
+void box_dims(fftw_iodim *dims, int32_t full, int8_t forward){
+  int32_t size = full / 2 + 1;
+  int32_t real[3] = {full * full, full, 1};
+  int32_t fourier[3] = {full * size, size, 1};
+  for (int32_t i = 0; i < 3; i++){
+    dims[i].n = full;
+    dims[i].is = forward ? real[i] : fourier[i];
+    dims[i].os = forward ? fourier[i] : real[i];
+  }
+  return;
+}
+
+// Planner effort for plans made before the maps hold data
+static unsigned effort = FFTW_MEASURE;
+
+// Set planner effort
+void set_plan_effort(unsigned flags){
+  effort = flags;
+  return;
+}
+
+unsigned plan_effort(void){
+  return effort;
+}
+
+// Forward transform into the current half transform layout
+fftw_plan plan_r2c(int32_t full, real_t *in, fftw_complex *out, unsigned flags){
+  fftw_iodim dims[3];
+  fftw_plan plan;
+  if (!split_layout()){
+    plan = fftw_plan_dft_r2c_3d(full, full, full, in, out, flags);
+  } else {
+    box_dims(dims, full, 1);
+    plan = fftw_plan_guru_split_dft_r2c(3, dims, 0, NULL, in, (real_t *) out, (real_t *) out + split_offset(full), flags);
+  }
+  // Without wisdom estimate rather than measure over maps in use
+  if (!plan && (flags & FFTW_WISDOM_ONLY)){
+    plan = plan_r2c(full, in, out, FFTW_ESTIMATE);
+  }
+  return plan;
+}
+
+// Inverse transform from the current half transform layout
+fftw_plan plan_c2r(int32_t full, fftw_complex *in, real_t *out, unsigned flags){
+  fftw_iodim dims[3];
+  fftw_plan plan;
+  if (!split_layout()){
+    plan = fftw_plan_dft_c2r_3d(full, full, full, in, out, flags);
+  } else {
+    box_dims(dims, full, 0);
+    plan = fftw_plan_guru_split_dft_c2r(3, dims, 0, NULL, (real_t *) in, (real_t *) in + split_offset(full), out, flags);
+  }
+  if (!plan && (flags & FFTW_WISDOM_ONLY)){
+    plan = plan_c2r(full, in, out, FFTW_ESTIMATE);
+  }
+  return plan;
+}
+
+// Inverse transforms of consecutive half transforms into consecutive real maps
+fftw_plan plan_c2r_many(int32_t full, int32_t count, fftw_complex *in, real_t *out, unsigned flags){
+  int n[3] = {full, full, full};
+  int64_t r_sz = (int64_t) full * full * full;
+  fftw_iodim dims[3], many;
+  fftw_plan plan;
+  if (!split_layout() && (real_t *) in == out){
+    // In place each map keeps the padded rows and spacing of its half transform
+    int pad[3] = {full, full, 2 * (full / 2 + 1)};
+    plan = fftw_plan_many_dft_c2r(3, n, count, in, NULL, 1, (int) fourier_stride(full), out, pad, 1, (int) (2 * fourier_stride(full)), flags);
+  } else if (!split_layout()){
+    plan = fftw_plan_many_dft_c2r(3, n, count, in, NULL, 1, (int) fourier_stride(full), out, NULL, 1, (int) r_sz, flags);
+  } else {
+    // Split strides are in reals - each transform holds both planes
+    box_dims(dims, full, 0);
+    many.n = count;
+    many.is = (int) (2 * fourier_stride(full));
+    many.os = (int) r_sz;
+    plan = fftw_plan_guru_split_dft_c2r(3, dims, 1, &many, (real_t *) in, (real_t *) in + split_offset(full), out, flags);
+  }
+  if (!plan && (flags & FFTW_WISDOM_ONLY)){
+    plan = plan_c2r_many(full, count, in, out, FFTW_ESTIMATE);
+  }
+  return plan;
+}
+
+// Execute plans for both half maps - concurrently if groups are split
+void execute_halves(fftw_plan plan1, fftw_plan plan2){
+  half_arg arg[2];
+  arg[0].plan = plan1;
+  arg[1].plan = plan2;
+  run_split((void*) half_thread, arg, sizeof(arg[0]));
+  return;
+}
+
+void half_thread(half_arg *arg){
+  // FFTW threads follow the group through the pool callback
+  fftw_execute(arg->plan);
+  return;
+}
+
+// Inverse plans that may run pruned and the rows holding the mask
+static pruned prunes[PRUNED_PLANS];
+static int32_t nprunes = 0;
+static int8_t pruning = 0;
+static int32_t mask_lo[2] = {0, 0};
+static int32_t mask_hi[2] = {0, 0};
+
+// FFTW planner is not thread safe - shells planning while others run take this
+static pthread_mutex_t planner = PTHREAD_MUTEX_INITIALIZER;
+
+void lock_planner(void){
+  pthread_mutex_lock(&planner);
+  return;
+}
+
+void unlock_planner(void){
+  pthread_mutex_unlock(&planner);
+  return;
+}
+
+// Enable pruned inverse transforms and find the sections and rows the mask touches
+void set_pruning(int8_t mode, r_mrc *mask){
+  int32_t full = mask->n_crs[0], z, y, x;
+  float *row;
+  pruning = mode;
+  if (!mode){
+    return;
+  }
+  mask_lo[0] = mask_lo[1] = full;
+  mask_hi[0] = mask_hi[1] = -1;
+  for (z = 0; z < full; z++){
+    for (y = 0; y < full; y++){
+      row = mask->data + ((int64_t) z * full + y) * full;
+      for (x = 0; x < full; x++){
+        // Same cut as the statistics use
+        if (row[x] >= 0.99){
+          mask_lo[0] = (z < mask_lo[0]) ? z : mask_lo[0];
+          mask_hi[0] = (z > mask_hi[0]) ? z : mask_hi[0];
+          mask_lo[1] = (y < mask_lo[1]) ? y : mask_lo[1];
+          mask_hi[1] = (y > mask_hi[1]) ? y : mask_hi[1];
+          break;
+        }
+      }
+    }
+  }
+  if (mask_hi[0] < 0){
+    // Nothing inside - keep every row
+    mask_lo[0] = mask_lo[1] = 0;
+    mask_hi[0] = mask_hi[1] = full - 1;
+  }
+  return;
+}
+
+// Register an inverse plan with its maps - row passes are planned now before the maps hold data
+void prune_plan(fftw_plan plan, fftw_complex *in, real_t *out, int32_t full, int32_t nthreads){
+  int32_t size = full / 2 + 1, pitch = ((real_t *) in == out) ? 2 * size : full, i;
+  fftw_iodim dims, many[2];
+  pruned *p;
+  if (!pruning || split_layout() || nprunes == PRUNED_PLANS){
+    // Further plans run whole
+    return;
+  }
+  for (i = 0; i < nprunes; i++){
+    if (prunes[i].plan == plan){
+      return;
+    }
+  }
+  p = &prunes[nprunes];
+  p->plan = plan;
+  p->in = in;
+  p->out = out;
+  p->full = full;
+  p->threads = nthreads;
+  p->bands = calloc(size, sizeof(band));
+  // Last pass is one real transform per row - in place rows keep the padding of their half transform
+  dims.n = full;
+  dims.is = 1;
+  dims.os = 1;
+  many[0].n = full;
+  many[0].is = full * size;
+  many[0].os = full * pitch;
+  many[1].n = full;
+  many[1].is = size;
+  many[1].os = pitch;
+  fftw_plan_with_nthreads(nthreads);
+  p->rows = fftw_plan_guru_dft_c2r(1, &dims, 2, many, in, out, plan_effort());
+  // Only sections and rows through the mask where nothing else is read
+  many[0].n = mask_hi[0] - mask_lo[0] + 1;
+  many[1].n = mask_hi[1] - mask_lo[1] + 1;
+  p->mask = fftw_plan_guru_dft_c2r(1, &dims, 2, many, in + ((int64_t) mask_lo[0] * full + mask_lo[1]) * size, out + ((int64_t) mask_lo[0] * full + mask_lo[1]) * pitch, plan_effort());
+  nprunes++;
+  return;
+}
+
+// Registered plan and band radius if enough columns are empty to prune
+pruned *find_pruned(fftw_plan plan, uint32_t hi, int32_t *radius){
+  int32_t i, r;
+  for (i = 0; i < nprunes; i++){
+    if (prunes[i].plan != plan){
+      continue;
+    }
+    r = band_radius(hi);
+    if (r + 1 + PRUNE_MARGIN > prunes[i].full / 2 + 1){
+      return NULL;
+    }
+    *radius = r;
+    return &prunes[i];
+  }
+  return NULL;
+}
+
+// Column passes for one band radius - planned by the first shell to need them
+band *get_band(pruned *plan, int32_t radius){
+  band *b = &plan->bands[radius];
+  lock_planner();
+  if (!b->cols){
+    fftw_plan_with_nthreads(plan->threads);
+    // Maps are in use - estimate rather than measure without wisdom
+    if (!plan_band(plan, radius, b, plan_effort() | FFTW_WISDOM_ONLY)){
+      plan_band(plan, radius, b, FFTW_ESTIMATE);
+    }
+  }
+  unlock_planner();
+  return b;
+}
+
+int8_t plan_band(pruned *plan, int32_t radius, band *b, unsigned flags){
+  int32_t full = plan->full, size = full / 2 + 1;
+  fftw_complex *top = plan->in + (int64_t) (full - radius) * size;
+  fftw_iodim dims, many[2];
+  // Along z in place through rows within the radius of y = 0 and x up to the radius
+  dims.n = full;
+  dims.is = dims.os = full * size;
+  many[0].n = radius + 1;
+  many[0].is = many[0].os = size;
+  many[1].n = radius + 1;
+  many[1].is = many[1].os = 1;
+  b->low = fftw_plan_guru_dft(1, &dims, 2, many, plan->in, plan->in, FFTW_BACKWARD, flags);
+  // Negative y frequencies sit at the top of each section
+  many[0].n = radius;
+  b->high = radius ? fftw_plan_guru_dft(1, &dims, 2, many, top, top, FFTW_BACKWARD, flags) : NULL;
+  // Along y through every section and x up to the radius
+  dims.is = dims.os = size;
+  many[0].n = full;
+  many[0].is = many[0].os = full * size;
+  b->cols = fftw_plan_guru_dft(1, &dims, 2, many, plan->in, plan->in, FFTW_BACKWARD, flags);
+  if (b->low && (b->high || !radius) && b->cols){
+    return 1;
+  }
+  if (b->low){
+    fftw_destroy_plan(b->low);
+  }
+  if (b->high){
+    fftw_destroy_plan(b->high);
+  }
+  if (b->cols){
+    fftw_destroy_plan(b->cols);
+  }
+  memset(b, 0, sizeof(band));
+  return 0;
+}
+
+// Run an inverse plan over the band within squared radius hi - whole if too wide or unregistered
+void execute_pruned(fftw_plan plan, uint32_t hi, int8_t inside){
+  int32_t radius;
+  pruned *p = find_pruned(plan, hi, &radius);
+  if (!p){
+    fftw_execute(plan);
+    return;
+  }
+  execute_band_plan(p, radius, inside);
+  return;
+}
+
+// Execute both half map plans over the band on their groups
+void execute_band(fftw_plan plan1, fftw_plan plan2, uint32_t hi, int8_t inside){
+  band_arg arg[2];
+  arg[0].plan = find_pruned(plan1, hi, &arg[0].radius);
+  arg[1].plan = find_pruned(plan2, hi, &arg[1].radius);
+  if (!arg[0].plan || !arg[1].plan){
+    // Whole transforms
+    execute_halves(plan1, plan2);
+    return;
+  }
+  arg[0].inside = arg[1].inside = inside;
+  run_split((void*) band_thread, arg, sizeof(arg[0]));
+  return;
+}
+
+void band_thread(band_arg *arg){
+  execute_band_plan(arg->plan, arg->radius, arg->inside);
+  return;
+}
+
+void execute_band_plan(pruned *plan, int32_t radius, int8_t inside){
+  band *b = get_band(plan, radius);
+  // Coefficients beyond the radius are zero so their columns are skipped
+  fftw_execute(b->low);
+  if (b->high){
+    fftw_execute(b->high);
+  }
+  fftw_execute(b->cols);
+  fftw_execute(inside ? plan->mask : plan->rows);
+  return;
+}
+
+// Destroy pruned passes
+void free_pruned(void){
+  int32_t i, r;
+  for (i = 0; i < nprunes; i++){
+    for (r = 0; r < prunes[i].full / 2 + 1; r++){
+      if (prunes[i].bands[r].cols){
+        fftw_destroy_plan(prunes[i].bands[r].low);
+        if (prunes[i].bands[r].high){
+          fftw_destroy_plan(prunes[i].bands[r].high);
+        }
+        fftw_destroy_plan(prunes[i].bands[r].cols);
+      }
+    }
+    free(prunes[i].bands);
+    fftw_destroy_plan(prunes[i].rows);
+    fftw_destroy_plan(prunes[i].mask);
+  }
+  nprunes = 0;
+  return;
+}
@@ -0,0 +1,94 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Inclusions
+#include <stdio.h>
+#include <signal.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <complex.h>
+#include <fftw3.h>
+
+// Inverse plans that may run pruned to the band of their filter
+#define PRUNED_PLANS 16
+
+// Bands must leave at least this many of the columns along x empty to be pruned
+#define PRUNE_MARGIN 4
+
+// Half map thread arguments structure
+typedef struct{
+  fftw_plan     plan;
+} CACHE_ALIGN half_arg;
+
+// Column passes over the coefficients within one band radius
+typedef struct{
+  fftw_plan   low;
+  fftw_plan  high;
+  fftw_plan  cols;
+} band;
+
+// Inverse plan with its pruned passes - bands are planned when first needed
+typedef struct{
+  fftw_plan     plan;
+  fftw_complex   *in;
+  real_t        *out;
+  fftw_plan     rows;
+  fftw_plan     mask;
+  band        *bands;
+  int32_t       full;
+  int32_t    threads;
+} pruned;
+
+// Pruned half map thread arguments structure
+typedef struct{
+  pruned       *plan;
+  int32_t    radius;
+  int8_t     inside;
+} CACHE_ALIGN band_arg;
+
+void box_dims(fftw_iodim *dims, int32_t full, int8_t forward);
+// Guru dimensions between real map and half transform
+
+void half_thread(half_arg *arg);
+// Execute plan for one half map
+// pthread function
+
+pruned *find_pruned(fftw_plan plan, uint32_t hi, int32_t *radius);
+// Registered plan if the band within squared radius hi is narrow enough to prune
+// NULL otherwise
+
+band *get_band(pruned *plan, int32_t radius);
+// Column passes for the band radius - planned on first use
+
+int8_t plan_band(pruned *plan, int32_t radius, band *b, unsigned flags);
+// Plan column passes along z and y through the band
+// Returns 0 and leaves the band empty if any plan fails
+
+void band_thread(band_arg *arg);
+// Execute pruned passes for one half map
+// pthread function
+
+void execute_band_plan(pruned *plan, int32_t radius, int8_t inside);
+// Columns through the band along z then y, then every real row or those through the mask
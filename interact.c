@@ -19,20 +19,35 @@
  */
 
 // Library header inclusion for linking                                  
+#define _GNU_SOURCE
 #include "sidesplitter.h"
+#include <sched.h>
 
 int get_num_jobs(void){
   // Obtain thread number from environmental variables
   char* thread_number = getenv("OMP_NUM_THREADS");
-  int nthreads = 0;
+  int nthreads = 0, quota;
+  cpu_set_t cpus;
   if (thread_number){
     // If thread number specified by user - use this one
     nthreads = atoi(thread_number);
   }
+  if (nthreads > 0){
+    return nthreads;
+  }
+  if (!sched_getaffinity(0, sizeof(cpus), &cpus)){
+    // If thread number still not set - count CPUs we may run on
+    nthreads = CPU_COUNT(&cpus);
+  }
   if (nthreads < 1){
-    // If thread number still not set - try sysconf
+    // If affinity unavailable - try sysconf
     nthreads = sysconf(_SC_NPROCESSORS_ONLN);
   }
+  quota = cgroup_cpus();
+  if (quota > 0 && quota < nthreads){
+    // If a cgroup quota is set - do not exceed it
+    nthreads = quota;
+  }
   if (nthreads < 1){
     // If variables are both empty - use a single thread
     nthreads = 1;
@@ -40,6 +55,83 @@ int get_num_jobs(void){
   return nthreads;
 }
 
+// Read quota and period and round up to whole CPUs
+static int read_quota(char *path, char *period_path){
+  long quota = 0, period = 0;
+  FILE *f = fopen(path, "r");
+  if (!f){
+    return -1;
+  }
+  // Version 2 holds both in one file and writes max if unlimited
+  if (!period_path){
+    if (fscanf(f, "%ld %ld", &quota, &period) != 2){
+      quota = 0;
+    }
+  } else if (fscanf(f, "%ld", &quota) != 1){
+    quota = 0;
+  }
+  fclose(f);
+  if (period_path){
+    f = fopen(period_path, "r");
+    if (!f || fscanf(f, "%ld", &period) != 1){
+      period = 0;
+    }
+    if (f){
+      fclose(f);
+    }
+  }
+  if (quota <= 0 || period <= 0){
+    return 0;
+  }
+  return (int) ((quota + period - 1) / period);
+}
+
+int cgroup_cpus(void){
+  char line[1024], path[1400], period[1400], *ctrl, *dir, *tok;
+  int cpus = -1, i;
+  FILE *f = fopen("/proc/self/cgroup", "r");
+  if (!f){
+    return 0;
+  }
+  while (cpus < 0 && fgets(line, sizeof(line), f)){
+    // Lines are hierarchy:controllers:path
+    line[strcspn(line, "\n")] = '\0';
+    ctrl = strchr(line, ':');
+    if (!ctrl){
+      continue;
+    }
+    dir = strchr(++ctrl, ':');
+    if (!dir){
+      continue;
+    }
+    *dir++ = '\0';
+    // Try the group itself then the mount root as seen from a container
+    for (i = 0; i < 2 && cpus < 0; i++){
+      if (*ctrl == '\0'){
+        snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", i ? "" : dir);
+        cpus = read_quota(path, NULL);
+      } else {
+        for (tok = ctrl; tok; tok = strchr(tok, ',') ? strchr(tok, ',') + 1 : NULL){
+          if (!strncmp(tok, "cpu", 3) && (tok[3] == ',' || tok[3] == '\0')){
+            snprintf(path, sizeof(path), "/sys/fs/cgroup/%s%s/cpu.cfs_quota_us", ctrl, i ? "" : dir);
+            snprintf(period, sizeof(period), "/sys/fs/cgroup/%s%s/cpu.cfs_period_us", ctrl, i ? "" : dir);
+            cpus = read_quota(path, period);
+            if (cpus < 0){
+              // Controllers are often also mounted singly
+              snprintf(path, sizeof(path), "/sys/fs/cgroup/cpu%s/cpu.cfs_quota_us", i ? "" : dir);
+              snprintf(period, sizeof(period), "/sys/fs/cgroup/cpu%s/cpu.cfs_period_us", i ? "" : dir);
+              cpus = read_quota(path, period);
+            }
+            break;
+          }
+        }
+      }
+    }
+  }
+  fclose(f);
+  return (cpus > 0) ? cpus : 0;
+}
+
 arguments *parse_args(int argc, char **argv){
 
   // Print usage and disclaimer
@@ -143,12 +235,39 @@ arguments *parse_args(int argc, char **argv){
   printf("\n%s\n\n", splash);
 
   if (argc < 7){
-    printf("\n    Usage: %s --v1 half_map1.mrc --v2 half_map2.mrc --mask mask.mrc [ --spectrum || --rotfl ]\n\n", argv[0]);
+    printf("\n    Usage: %s --v1 half_map1.mrc --v2 half_map2.mrc --mask mask.mrc [ --spectrum || --rotfl ] [ --hugepages thp|hugetlb ] [ --pagereport ] [ --autotune ] [ --profile file ] [ --splithalves ] [ --speculate tol ] [ --annulus eps ] [ --fscprofile ] [ --fsccheck tol ] [ --simd scalar|sse2|avx2|avx512 ] [ --splitcomplex ] [ --benchlayout ] [ --shellbatch n ] [ --reapplycheck tol ] [ --realnorm ] [ --parseval ] [ --sumcheck ] [ --inplace ] [ --prunefft ] [ --coarse ] [ --planeffort estimate|measure|patient|exhaustive ] [ --wisdom file ] [ --makewisdom n1,n2,... ]\n\n", argv[0]);
   }
 
   printf("    PLEASE NOTE: SIDESPLITTER requires the unfiltered halfmaps and mask from each iteration or your results will be invalid\n");
   printf("                 Setting flag --spectrum outputs the natural SNR weighted spectrum rather than matching your input spectrum\n");
   printf("                 Setting flag --rotfl performs SNR tapering, matching input density in real-space rather than Fourier-space\n");
+  printf("                 Setting --hugepages thp or hugetlb backs the map buffers with transparent or reserved huge pages\n");
+  printf("                 Setting flag --pagereport prints the NUMA node placement of the map buffers after allocation\n");
+  printf("                 Setting flag --autotune times each stage to find its best thread count and saves them to the profile\n");
+  printf("                 Setting --profile file stores thread counts there rather than in ~/.sidesplitter_profile for later runs\n");
+  printf("                 Setting flag --splithalves processes the two half maps at the same time on two groups of threads\n");
+  printf("                 Setting --speculate tol filters the next pass 1 shell while the current one finishes, keeping it if its step is within tol (relative)\n");
+  printf("                 Setting --annulus eps skips Fourier coefficients whose filter weight is at most eps (0 skips only exact zeros)\n");
+  printf("                 Setting flag --fscprofile reads pass 1 shell FSCs from a radial cross-spectrum rather than summing every coefficient\n");
+  printf("                 Setting --fsccheck tol computes both and warns where the profile FSC differs by more than tol (implies --fscprofile)\n");
+  printf("                 Setting --simd scalar, sse2, avx2 or avx512 forces the Fourier kernels rather than picking the widest the CPU supports (single precision builds have scalar kernels only)\n");
+  printf("                 Setting flag --splitcomplex stores real and imaginary parts of Fourier maps separately so kernels use full vector width\n");
+  printf("                 Setting flag --benchlayout times the Fourier kernels and FFT with interleaved and split storage before running\n");
+  printf("                 Setting --shellbatch n filters n consecutive shells per sweep in passes 2 and 3 and transforms them together (up to %i)\n", SHELL_BATCH);
+  printf("                 Setting --reapplycheck tol also reapplies the spectrum shell by shell and warns if the single composite filter differs by more than tol\n");
+  printf("                 Setting flag --realnorm sums the pass 1 normalised shells in real space rather than as one radial filter in Fourier space\n");
+  printf("                 Setting flag --parseval takes pass 1 noise and power over the WHOLE BOX from the spectrum with no inverse transforms\n");
+  printf("                     - the mask is ignored for these statistics, so only use it when unmasked whole-box statistics are wanted\n");
+  printf("                 Setting flag --sumcheck compares the FSC, spectrum and power sums against a compensated long double reference\n");
+  printf("                 Setting flag --inplace runs inverse transforms in place so shell maps share the buffers of their half transforms\n");
+  printf("                     - this saves two or more map buffers per half but implies interleaved storage\n");
+  printf("                 Setting flag --prunefft skips the inverse transform columns beyond each shell's band and pass 1 rows outside the mask\n");
+  printf("                     - bands come from --annulus eps, so it needs eps > 0 and implies interleaved storage\n");
+  printf("                 Setting flag --coarse takes the noise and power of low resolution pass 1 shells on Fourier cropped boxes\n");
+  printf("                     - the sums match the full box as the cropped maps hold the whole band, but it needs --annulus eps > 0\n");
+  printf("                 Setting --planeffort estimate, measure, patient or exhaustive sets how hard FFTW searches for fast plans (default measure)\n");
+  printf("                 Setting --wisdom file stores FFTW plans there rather than in ~/.sidesplitter_wisdom, by box size, FFT threads, precision and CPU\n");
+  printf("                 Setting --makewisdom n1,n2,... plans the transforms for each box size listed, stores the wisdom and exits\n");
   printf("                 Remember - Junk in = Junk out! Please report any bug or observation to c.aylett@imperial.ac.uk, good luck!\n\n");
   printf("    SIDESPLITTER V1.2: LAFTER algorithm for halfmaps - 06-06-2020 GNU Public Licensed - K Ramlaul, CM Palmer and CHS Aylett\n\n");
 
@@ -156,6 +275,11 @@ arguments *parse_args(int argc, char **argv){
   int i;
   arguments *args = malloc(sizeof(arguments));
   memset(args, 0, sizeof(arguments));
+  args->eps = -1.0;
+  args->chk = -1.0;
+  args->rchk = -1.0;
+  args->simd = SIMD_AUTO;
+  args->plan = FFTW_MEASURE;
   for (i = 1; i < argc; i++){
     if (!strcmp(argv[i], "--v1") && ((i + 1) < argc)){
       args->vol1 = argv[i + 1];
@@ -167,7 +291,137 @@ arguments *parse_args(int argc, char **argv){
       args->spec = 1;
     } else if (!strcmp(argv[i], "--rotfl")){
       args->rotf = 1;
+    } else if (!strcmp(argv[i], "--hugepages") && ((i + 1) < argc)){
+      if (!strcmp(argv[i + 1], "thp")){
+        args->page = THP_PAGES;
+      } else if (!strcmp(argv[i + 1], "hugetlb")){
+        args->page = HUGETLB_PAGES;
+      } else {
+        printf("    Huge page type %s not recognised - use thp or hugetlb\n\n", argv[i + 1]);
+        exit(1);
+      }
+    } else if (!strcmp(argv[i], "--pagereport")){
+      args->numa = 1;
+    } else if (!strcmp(argv[i], "--splithalves")){
+      args->half = 1;
+    } else if (!strcmp(argv[i], "--speculate") && ((i + 1) < argc)){
+      args->look = 1;
+      args->tol = atof(argv[i + 1]);
+    } else if (!strcmp(argv[i], "--annulus") && ((i + 1) < argc)){
+      args->eps = atof(argv[i + 1]);
+    } else if (!strcmp(argv[i], "--fscprofile")){
+      args->fscp = 1;
+    } else if (!strcmp(argv[i], "--fsccheck") && ((i + 1) < argc)){
+      args->fscp = 1;
+      args->chk = atof(argv[i + 1]);
+    } else if (!strcmp(argv[i], "--simd") && ((i + 1) < argc)){
+      if (!strcmp(argv[i + 1], "scalar")){
+        args->simd = SIMD_SCALAR;
+      } else if (!strcmp(argv[i + 1], "sse2")){
+        args->simd = SIMD_SSE2;
+      } else if (!strcmp(argv[i + 1], "avx2")){
+        args->simd = SIMD_AVX2;
+      } else if (!strcmp(argv[i + 1], "avx512")){
+        args->simd = SIMD_AVX512;
+      } else {
+        printf("    Kernel type %s not recognised - use scalar, sse2, avx2 or avx512\n\n", argv[i + 1]);
+        exit(1);
+      }
+    } else if (!strcmp(argv[i], "--splitcomplex")){
+      args->soa = 1;
+    } else if (!strcmp(argv[i], "--benchlayout")){
+      args->bench = 1;
+    } else if (!strcmp(argv[i], "--shellbatch") && ((i + 1) < argc)){
+      args->batch = atoi(argv[i + 1]);
+      if (args->batch < 1 || args->batch > SHELL_BATCH){
+        printf("    Shell batch %s out of range - use 1 to %i\n\n", argv[i + 1], SHELL_BATCH);
+        exit(1);
+      }
+    } else if (!strcmp(argv[i], "--reapplycheck") && ((i + 1) < argc)){
+      args->rchk = atof(argv[i + 1]);
+    } else if (!strcmp(argv[i], "--realnorm")){
+      args->rnrm = 1;
+    } else if (!strcmp(argv[i], "--parseval")){
+      args->pars = 1;
+    } else if (!strcmp(argv[i], "--sumcheck")){
+      args->schk = 1;
+    } else if (!strcmp(argv[i], "--inplace")){
+      args->inpl = 1;
+    } else if (!strcmp(argv[i], "--prunefft")){
+      args->prun = 1;
+    } else if (!strcmp(argv[i], "--coarse")){
+      args->crs = 1;
+    } else if (!strcmp(argv[i], "--planeffort") && ((i + 1) < argc)){
+      if (!strcmp(argv[i + 1], "estimate")){
+        args->plan = FFTW_ESTIMATE;
+      } else if (!strcmp(argv[i + 1], "measure")){
+        args->plan = FFTW_MEASURE;
+      } else if (!strcmp(argv[i + 1], "patient")){
+        args->plan = FFTW_PATIENT;
+      } else if (!strcmp(argv[i + 1], "exhaustive")){
+        args->plan = FFTW_EXHAUSTIVE;
+      } else {
+        printf("    Planner effort %s not recognised - use estimate, measure, patient or exhaustive\n\n", argv[i + 1]);
+        exit(1);
+      }
+    } else if (!strcmp(argv[i], "--wisdom") && ((i + 1) < argc)){
+      args->wisd = argv[i + 1];
+    } else if (!strcmp(argv[i], "--makewisdom") && ((i + 1) < argc)){
+      args->wsz = argv[i + 1];
+    } else if (!strcmp(argv[i], "--autotune")){
+      args->tune = 1;
+    } else if (!strcmp(argv[i], "--profile") && ((i + 1) < argc)){
+      args->prof = argv[i + 1];
+    }
+  }
+  if (args->pars){
+    // No real-space shells exist to sum
+    args->rnrm = 0;
+  }
+  if (args->pars && args->mask){
+    printf("    Warning - --parseval takes pass 1 noise and power over the whole box, so %s is not used for them\n\n", args->mask);
+  }
+  if (args->inpl){
+    // Padded real rows fit only interleaved half transforms of their own
+    args->soa = 0;
+  }
+  if (args->prun && args->eps < 0.0){
+    // Without an annulus every filter reaches the corners of the box
+    printf("    Pruned transforms need --annulus eps to bound each band - running whole transforms\n\n");
+    args->prun = 0;
+  }
+  if (args->prun){
+    // Column passes stride through interleaved half transforms
+    args->soa = 0;
+  }
+  if (args->crs && args->eps < 0.0){
+    printf("    Coarse boxes need --annulus eps to bound each band - running full boxes\n\n");
+    args->crs = 0;
+  }
+  if (args->rnrm || args->pars){
+    // Shells summed in real space need their full maps and whole-box statistics need none
+    args->crs = 0;
+  }
+  if (!args->prof && getenv("HOME")){
+    // Default thread profile lives in the home directory
+    size_t length = snprintf(NULL, 0, "%s/.sidesplitter_profile", getenv("HOME")) + 1;
+    args->prof = malloc(length);
+    sprintf(args->prof, "%s/.sidesplitter_profile", getenv("HOME"));
+  }
+  if (!args->wisd && getenv("HOME")){
+    // Default wisdom store lives beside the thread profile
+    size_t length = snprintf(NULL, 0, "%s/.sidesplitter_wisdom", getenv("HOME")) + 1;
+    args->wisd = malloc(length);
+    sprintf(args->wisd, "%s/.sidesplitter_wisdom", getenv("HOME"));
+  }
+  if (args->wsz){
+    if (!args->wisd){
+      printf("    No wisdom store - set --wisdom file to generate wisdom\n\n");
+      exit(1);
     }
+    // Generating wisdom needs no maps and times nothing
+    args->tune = 0;
+    return args;
   }
   if (args->vol1 == NULL || args->vol2 == NULL){
     printf("    Necessary maps not found or unspecified - SIDESPLITTER absolutely requires the two halfset volumes and any mask applied\n\n");
@@ -260,7 +514,7 @@ r_mrc *read_mrc(char *filename){
 }
 
 // Write MRC file given an mrc structure and corresponding data
-void write_mrc(r_mrc* header, double *vol, char* filename, int32_t size){
+void write_mrc(r_mrc* header, real_t *vol, char* filename, int32_t size){
 
   int i;
   double total    = size * size * size;
@@ -275,7 +529,7 @@ void write_mrc(r_mrc* header, double *vol, char* filename, int32_t size){
   }
 
   for (i = 0; i < total; i++){
-    // Convert double map to float for writing out
+    // Convert map to float for writing out
     header->data[i] = (float) vol[i];
   }
 
@@ -29,6 +29,17 @@ int main(int argc, char **argv){
   // Get arguments
   arguments *args = parse_args(argc, argv);
   int32_t nthread = get_num_jobs();
+  start_pool(nthread);
+  set_plan_effort(args->plan);
+
+  // Pre-generate wisdom and exit
+  if (args->wsz){
+    fftw_init_threads();
+    fftw_pool();
+    make_wisdom(args, nthread);
+    stop_pool();
+    return 0;
+  }
   
   // Read MRC inputs
   r_mrc *vol1 = read_mrc(args->vol1);
@@ -48,82 +59,149 @@ int main(int argc, char **argv){
     return 1;
   }
 
-  size_t r_st = xyz * xyz * xyz * sizeof(double);
-  size_t k_st = xyz * xyz * ((xyz / 2) + 1) * sizeof(fftw_complex);
+  size_t r_st = xyz * xyz * xyz * sizeof(real_t);
 
   // FFTW set-up
   printf("\n\t Setting up threads and maps\n");
   printf("\n\t Using %i threads. If you want to override this, set the OMP_NUM_THREADS environment variable.\n", nthread);
   fftw_init_threads();
-  fftw_plan_with_nthreads(nthread);
-
-  // Allocate memory for maps
-  double *ri1 = fftw_malloc(r_st);
-  double *ri2 = fftw_malloc(r_st);
-  double *ro1 = fftw_malloc(r_st);
-  double *ro2 = fftw_malloc(r_st);
-  fftw_complex *ki1 = fftw_malloc(k_st);
-  fftw_complex *ki2 = fftw_malloc(k_st);
-  fftw_complex *ko1 = fftw_malloc(k_st);
-  fftw_complex *ko2 = fftw_malloc(k_st);
+  fftw_pool();
+  set_kernels(args->simd);
+  set_layout(args->soa, xyz);
+  size_t k_st = fourier_bytes(xyz);
+  if (args->soa){
+    printf("\n\t Fourier maps stored as split real and imaginary planes\n");
+  }
+#ifdef SINGLE_PRECISION
+  printf("\n\t Maps, transforms and Fourier kernels in single precision\n");
+#endif
+
+  // Thread counts per stage from profile or tuning
+  jobs *nt = stage_jobs(args, mask, xyz, nthread);
+  if (args->bench){
+    bench_layout(args->soa, nt, xyz);
+  }
+  fftw_plan_with_nthreads(nt->fft);
+
+  // Plans from earlier runs on this box, thread count and CPU
+  if (args->wisd && read_wisdom(args->wisd, xyz, nt->fft)){
+    printf("\n\t FFTW wisdom read from %s\n", args->wisd);
+  }
+
+  // Run half maps concurrently on two thread groups
+  int8_t split = (args->half || args->look) && split_pool(nthread);
+  if (split){
+    printf("\n\t Half maps run concurrently on %i and %i threads\n", split_threads(0, nthread), split_threads(1, nthread));
+    fflush(stdout);
+  }
+
+  // Allocate memory for maps - first touched in parallel
+  // Output maps hold a ring of shells if batching
+  int32_t ring = (args->batch > 1) ? args->batch : 1;
+  set_pages(args->page);
+  set_inplace(args->inpl);
+  fftw_complex *ki1 = alloc_fourier(xyz, nt->fourier);
+  fftw_complex *ki2 = alloc_fourier(xyz, nt->fourier);
+  fftw_complex *ko1 = alloc_fouriers(xyz, ring, nt->fourier);
+  fftw_complex *ko2 = alloc_fouriers(xyz, ring, nt->fourier);
+  real_t *ro1 = alloc_real(xyz, nt->real);
+  real_t *ro2 = alloc_real(xyz, nt->real);
+  // Inverse transforms in place write padded rows over their half transforms
+  real_t *ri1 = args->inpl ? (real_t *) ko1 : alloc_reals(xyz, ring, nt->real);
+  real_t *ri2 = args->inpl ? (real_t *) ko2 : alloc_reals(xyz, ring, nt->real);
+  if (args->inpl){
+    printf("\n\t Inverse transforms run in place - shell maps share their half transform buffers\n");
+  }
   
+  // Fourier geometry shared by all kernels
+  get_geometry(xyz, nt->fourier);
+  set_filter_eps(args->eps);
+
   // Make FFTW plans
   printf("\n\t FFTW doing its thing - ");
   fflush(stdout);
-  fftw_plan fft_ro1_ki1 = fftw_plan_dft_r2c_3d(xyz, xyz, xyz, ro1, ki1, FFTW_MEASURE);
+  fftw_plan_with_nthreads(split_threads(0, nt->fft));
+  fftw_plan fft_ro1_ki1 = plan_r2c(xyz, ro1, ki1, plan_effort());
   printf("#");
   fflush(stdout);
-  fftw_plan fft_ro2_ki2 = fftw_plan_dft_r2c_3d(xyz, xyz, xyz, ro2, ki2, FFTW_ESTIMATE);
+  fftw_plan_with_nthreads(split_threads(1, nt->fft));
+  fftw_plan fft_ro2_ki2 = plan_r2c(xyz, ro2, ki2, plan_effort());
   printf("#");
   fflush(stdout);
-  fftw_plan fft_ko1_ri1 = fftw_plan_dft_c2r_3d(xyz, xyz, xyz, ko1, ri1, FFTW_MEASURE);
+  fftw_plan_with_nthreads(split_threads(0, nt->fft));
+  fftw_plan fft_ko1_ri1 = plan_c2r(xyz, ko1, ri1, plan_effort());
   printf("#");
   fflush(stdout);
-  fftw_plan fft_ko2_ri2 = fftw_plan_dft_c2r_3d(xyz, xyz, xyz, ko2, ri2, FFTW_ESTIMATE);
+  fftw_plan_with_nthreads(split_threads(1, nt->fft));
+  fftw_plan fft_ko2_ri2 = plan_c2r(xyz, ko2, ri2, plan_effort());
   printf("#\n");
   fflush(stdout);
 
+  // Inverse transforms skip the columns beyond the band of each shell
+  if (args->prun){
+    set_pruning(1, mask);
+    prune_plan(fft_ko1_ri1, ko1, ri1, xyz, split_threads(0, nt->fft));
+    prune_plan(fft_ko2_ri2, ko2, ri2, xyz, split_threads(1, nt->fft));
+  }
+
   // Zero fill maps
-  memset(ro1, 0, r_st);
-  memset(ro2, 0, r_st);
-  memset(ri1, 0, r_st);
-  memset(ri2, 0, r_st);
-  memset(ko1, 0, k_st);
-  memset(ko2, 0, k_st);
-  memset(ki1, 0, k_st);
-  memset(ki2, 0, k_st);
+  zero_real(ro1, xyz, nt->real);
+  zero_real(ro2, xyz, nt->real);
+  if (!args->inpl){
+    zero_real(ri1, xyz, nt->real);
+    zero_real(ri2, xyz, nt->real);
+  }
+  zero_fourier(ko1, xyz, nt->fourier);
+  zero_fourier(ko2, xyz, nt->fourier);
+  zero_fourier(ki1, xyz, nt->fourier);
+  zero_fourier(ki2, xyz, nt->fourier);
+
+  // Report page placement
+  if (args->numa){
+    printf("\n\t Page placement of map buffers\n\n");
+    if (!args->inpl){
+      report_pages("ri1", ri1, r_st);
+      report_pages("ri2", ri2, r_st);
+    }
+    report_pages("ro1", ro1, r_st);
+    report_pages("ro2", ro2, r_st);
+    report_pages("ki1", ki1, k_st);
+    report_pages("ki2", ki2, k_st);
+    report_pages("ko1", ko1, k_st);
+    report_pages("ko2", ko2, k_st);
+    report_huge_pages();
+    fflush(stdout);
+  }
 
   // Copy data into place
-  add_map(vol1, ro1, nthread);
-  add_map(vol2, ro2, nthread);
+  add_map(vol1, ro1, nt->real);
+  add_map(vol2, ro2, nt->real);
 
   // Apply masks in situ
-  apply_mask(mask, ro1, nthread);
-  apply_mask(mask, ro2, nthread);
+  apply_mask(mask, ro1, nt->real);
+  apply_mask(mask, ro2, nt->real);
   
   // Execute forward transform
-  fftw_execute(fft_ro1_ki1);
-  fftw_execute(fft_ro2_ki2);
+  execute_halves(fft_ro1_ki1, fft_ro2_ki2);
 
   // Obtain spectra
-  long double *spec1 = calloc(xyz, sizeof(long double));
-  long double *spec2 = calloc(xyz, sizeof(long double));
-  double maxres = get_spectrum(ki1, ki2, spec1, spec2, xyz, nthread);
+  double *spec1 = calloc(xyz, sizeof(double));
+  double *spec2 = calloc(xyz, sizeof(double));
+  double maxres = get_spectrum(ki1, ki2, spec1, spec2, xyz, nt->fourier);
 
   // Report FSC cut-off
   printf("\n\t FSC cut-off within mask = %12.6f \n", apix / maxres);
 
   // Zero fill maps
-  memset(ro1, 0, r_st);
-  memset(ro2, 0, r_st);
+  zero_real(ro1, xyz, nt->real);
+  zero_real(ro2, xyz, nt->real);
 
   // Copy data into place
-  add_map(vol1, ro1, nthread);
-  add_map(vol2, ro2, nthread);
+  add_map(vol1, ro1, nt->real);
+  add_map(vol2, ro2, nt->real);
 
   // Execute forward transform
-  fftw_execute(fft_ro1_ki1);
-  fftw_execute(fft_ro2_ki2);
+  execute_halves(fft_ro1_ki1, fft_ro2_ki2);
 
   // Copy across ffts if tapering
   fftw_complex *inpk1 = NULL;
@@ -131,16 +209,21 @@ int main(int argc, char **argv){
 
   if (args->rotf){
 
-    inpk1 = fftw_malloc(k_st);
-    inpk2 = fftw_malloc(k_st);
+    inpk1 = alloc_fourier(xyz, nt->fourier);
+    inpk2 = alloc_fourier(xyz, nt->fourier);
 
     memcpy(inpk1, ki1, k_st);
     memcpy(inpk2, ki2, k_st);
   }
+
+  // Check reductions on the unmasked maps and transforms
+  if (args->schk){
+    check_sums(ki1, ki2, ro1, ro2, mask, nt, xyz);
+  }
   
   // Zero fill maps
-  memset(ro1, 0, r_st);
-  memset(ro2, 0, r_st);
+  zero_real(ro1, xyz, nt->real);
+  zero_real(ro2, xyz, nt->real);
 
   // Initialise list
   list head;
@@ -154,6 +237,7 @@ int main(int argc, char **argv){
   list *tail = &head;
 
   double mean_p;
+  filter *table;
 
   // Noise suppression loop
   printf("\n\t Normalising -- Pass 1 \n");
@@ -162,23 +246,70 @@ int main(int argc, char **argv){
   printf("\n\t # FSC indicates the Fourier Shell Correlation between half sets -\n\n");
   fflush(stdout);
 
-  i = 0;
-  do {
-    if (tail->res == 0.0){
-      lowpass_filter(ki1, ko1, tail, xyz, nthread);
-      lowpass_filter(ki2, ko2, tail, xyz, nthread);
-    } else {
-      bandpass_filter(ki1, ko1, tail, xyz, nthread);
-      bandpass_filter(ki2, ko2, tail, xyz, nthread);
+  // Current shell and guessed next shell if speculating
+  shell ahead[2];
+  memset(ahead, 0, sizeof(ahead));
+  for (i = 0; i < 2; i++){
+    ahead[i].ki1 = ki1;
+    ahead[i].ki2 = ki2;
+    ahead[i].mask = mask;
+    ahead[i].size = xyz;
+    ahead[i].fourier = args->look ? split_threads(i, nt->fourier) : nt->fourier;
+    ahead[i].real = args->look ? split_threads(i, nt->real) : nt->real;
+  }
+  if (args->fscp || args->pars){
+    // Shell FSCs are read from the radial profile of the unfiltered halves
+    ahead[0].prof = get_profile(ki1, ki2, args->pars, xyz, nt->fourier);
+    ahead[1].prof = ahead[0].prof;
+  }
+  for (i = 0; i < 2; i++){
+    ahead[i].whole = args->pars;
+  }
+  for (i = 0; i < 2; i++){
+    ahead[i].check = args->chk;
+    ahead[i].apix = apix;
+    // Only the statistics within the mask are read unless shells are summed in real space
+    ahead[i].inside = !args->rnrm;
+  }
+  ahead[0].ko1 = ko1;
+  ahead[0].ko2 = ko2;
+  ahead[0].ri1 = ri1;
+  ahead[0].ri2 = ri2;
+  ahead[0].fft1 = fft_ko1_ri1;
+  ahead[0].fft2 = fft_ko2_ri2;
+  if (args->look){
+    alloc_shell(&ahead[1], 0, split_threads(1, nt->fft));
+  }
+  if (args->crs){
+    // Shell maps hold no data yet so serve to transform the mask
+    set_coarse(mask, ko1, ri1, xyz, nt->fft);
+    for (i = 0; i < (args->look ? 2 : 1); i++){
+      alloc_coarse(&ahead[i], args->look ? split_threads(i, nt->fft) : nt->fft);
     }
+  }
 
-    tail->fsc = calc_fsc(ko1, ko2, xyz, nthread);
-    tail->crf = sqrt(fabs((2.0 * tail->fsc) / (1.0 + tail->fsc)));
+  list guess;
+  shell swap;
+  double last_p = 0.0, prev_p = 0.0;
+  int32_t guess_hit = 0, guess_miss = 0;
+  int32_t coarse_hit = 0, coarse_all = 0;
+  int8_t ready = 0;
 
-    fftw_execute(fft_ko1_ri1);
-    fftw_execute(fft_ko2_ri2);
+  do {
+    // Guess next step by extrapolating the last probabilities
+    ahead[0].node = tail;
+    ahead[1].node = NULL;
+    if (args->look && last_p > 0.0){
+      memset(&guess, 0, sizeof(list));
+      guess.res = tail->res + tail->stp;
+      guess.stp = ((prev_p > 0.0) ? 2.0 * last_p - prev_p : last_p) * (guess.res / 64.0);
+      ahead[1].node = &guess;
+    }
 
-    mean_p = normalise(ri1, ri2, ro1, ro2, mask, tail, xyz, nthread);
+    mean_p = pass_ahead(ahead, args->rnrm ? ro1 : NULL, args->rnrm ? ro2 : NULL, ready);
+    ready = 0;
+    coarse_hit += (ahead[0].grid > 0);
+    coarse_all++;
     
     if (tail->res + tail->stp >= maxres || mean_p <= 0.05){
       maxres = tail->res + tail->stp;
@@ -190,15 +321,60 @@ int main(int argc, char **argv){
 
     tail = extend_list(tail, mean_p);
 
+    // Keep guessed shell if its step is close enough
+    if (ahead[1].node){
+      if (fabsl(tail->stp - guess.stp) <= args->tol * tail->stp){
+        tail->stp = guess.stp;
+        tail->fsc = guess.fsc;
+        tail->crf = guess.crf;
+        swap = ahead[0];
+        ahead[0] = ahead[1];
+        ahead[1] = swap;
+        ready = 1;
+        guess_hit++;
+      } else {
+        guess_miss++;
+      }
+    }
+    prev_p = last_p;
+    last_p = mean_p;
+
   } while (1);
 
-  // Back-transform noise-suppressed maps
-  fftw_execute(fft_ro1_ki1);
-  fftw_execute(fft_ro2_ki2);
+  if (args->look){
+    printf("\n\t Speculation | Hits = %i | Misses = %i | Hit rate = %6.2f%%\n", guess_hit, guess_miss, (guess_hit + guess_miss) ? 100.0 * guess_hit / (guess_hit + guess_miss) : 0.0);
+    fflush(stdout);
+  }
+
+  if (args->crs){
+    printf("\n\t Coarse boxes | Shells = %i of %i\n", coarse_hit, coarse_all);
+    fflush(stdout);
+    free_coarse(&ahead[0]);
+    free_coarse(&ahead[1]);
+    free_coarse_masks();
+  }
+
+  if (args->fscp || args->pars){
+    if (args->chk >= 0.0 && !args->pars){
+      printf("\n\t Profile FSC | Largest difference from full sum = %e\n", fmax(ahead[0].worst, ahead[1].worst));
+      fflush(stdout);
+    }
+    free_profile(ahead[0].prof);
+  }
+
+  if (args->rnrm){
+    // Back-transform noise-suppressed maps
+    execute_halves(fft_ro1_ki1, fft_ro2_ki2);
+  } else {
+    // Normalised shells sum to one radial filter of the input
+    table = composite_filter(&head, 0, xyz);
+    filter_pair(ki1, ki2, ki1, ki2, table, 0, xyz, nt->fourier);
+    put_filter(table);
+  }
 
   // Zero fill maps
-  memset(ro1, 0, r_st);
-  memset(ro2, 0, r_st);
+  zero_real(ro1, xyz, nt->real);
+  zero_real(ro2, xyz, nt->real);
 
   // Truncate by SNR
   printf("\n\t De-noising volume -- Pass 2 \n");
@@ -216,133 +392,162 @@ int main(int argc, char **argv){
   char *name2 = malloc(name_buffer);
   sprintf(name2, "%s%s", args->vol2, "_sidesplitter.mrc");
 
-  // Choose tapering loop if required
-  if (args->rotf){
-
-    double *ori1 = fftw_malloc(r_st);
-    double *ori2 = fftw_malloc(r_st);
-
-    memset(ori1, 0, r_st);
-    memset(ori2, 0, r_st);
-
-    fftw_complex *oki1 = fftw_malloc(k_st);
-    fftw_complex *oki2 = fftw_malloc(k_st);
-
-    memset(oki1, 0, k_st);
-    memset(oki2, 0, k_st);
+  // Shells are filtered as a ring in one sweep, or in pairs on the two groups if split
+  int32_t nshells = (ring > 1) ? ring : (split ? 2 : 1), n;
+  shell batch[SHELL_BATCH];
+  memset(batch, 0, sizeof(batch));
+  for (n = 0; n < nshells; n++){
+    batch[n].ki1 = ki1;
+    batch[n].ki2 = ki2;
+    batch[n].pk1 = inpk1;
+    batch[n].pk2 = inpk2;
+    batch[n].mask = mask;
+    batch[n].size = xyz;
+    batch[n].fourier = (ring > 1) ? nt->fourier : split_threads(n, nt->fourier);
+    batch[n].real = (ring > 1) ? nt->real : split_threads(n, nt->real);
+  }
+  batch[0].ko1 = ko1;
+  batch[0].ko2 = ko2;
+  batch[0].ri1 = ri1;
+  batch[0].ri2 = ri2;
+  if (ring > 1){
+    // Both passes over the shells end on the same short batch
+    int32_t count = 0;
+    for (list *shl = &head; shl; shl = shl->nxt){
+      count++;
+    }
+    alloc_ring(batch, ring, count % ring, args->rotf, nt->fft);
+    printf("\t # Filtering %i shells per sweep over the spectrum\n\n", ring);
+    fflush(stdout);
+  } else {
+    batch[0].fft1 = fft_ko1_ri1;
+    batch[0].fft2 = fft_ko2_ri2;
+    for (n = 0; n < nshells; n++){
+      alloc_shell(&batch[n], args->rotf, split_threads(n, nt->fft));
+    }
+  }
 
-    fftw_plan fft_oki1_ori1 = fftw_plan_dft_c2r_3d(xyz, xyz, xyz, oki1, ori1, FFTW_ESTIMATE);
-    fftw_plan fft_oki2_ori2 = fftw_plan_dft_c2r_3d(xyz, xyz, xyz, oki2, ori2, FFTW_ESTIMATE);
-  
-    do {
+  // Shell in which each voxel first rises above noise
+  int64_t total = (int64_t) xyz * xyz * xyz;
+  uint16_t *first1 = calloc(total, sizeof(uint16_t));
+  uint16_t *first2 = calloc(total, sizeof(uint16_t));
+  double hits[SHELL_BATCH];
+  double rcv = 0.0;
+  uint16_t base = 1;
+  list *node = tail;
 
-      lowpass_filter(ki1, ko1, tail, xyz, nthread);
-      lowpass_filter(ki2, ko2, tail, xyz, nthread);
+  while (node){
 
-      lowpass_filter(inpk1, oki1, tail, xyz, nthread);
-      lowpass_filter(inpk2, oki2, tail, xyz, nthread);
+    for (n = 0; n < nshells && node; n++){
+      batch[n].node = node;
+      node = node->prv;
+    }
 
-      fftw_execute(fft_ko1_ri1);
-      fftw_execute(fft_ko2_ri2);
+    run_shells(batch, n);
 
-      fftw_execute(fft_oki1_ori1);
-      fftw_execute(fft_oki2_ori2);
+    first_crossing(batch, n, base, ro1, ro2, first1, first2, hits, args->rotf, xyz, nt->real);
 
-      mean_p = taper_map(ri1, ri2, ro1, ro2, ori1, ori2, mask, tail, args, xyz, nthread);
+    for (i = 0; i < n; i++){
+      rcv += hits[i];
+      printf("\t Resolution = %12.6Lf | Recovery = %12.6f\n", apix / (batch[i].node->res + batch[i].node->stp), rcv / batch[i].count);
+    }
+    fflush(stdout);
+    base += n;
+  }
+  tail = &head;
 
-      printf("\t Resolution = %12.6Lf | Recovery = %12.6f\n", apix / (tail->res + tail->stp), mean_p);
-      fflush(stdout);
-    
-      if (tail->prv == NULL){
-	break;
-      } else{
-	tail = tail->prv;
-      }
+  free(first1);
+  free(first2);
 
-    } while (1);
+  // Output maps if SNR tapering
+  if (args->rotf){
 
     // Renormalise maps
-    int32_t total = xyz * xyz * xyz;
-
     for (i = 0; i < total; i++){
       ro1[i] /= (double) total;
       ro2[i] /= (double) total;
     }
 
-    // Output maps if SNR tapering
     write_mrc(vol1, ro1, name1, xyz);
     write_mrc(vol2, ro2, name2, xyz);
 
+    // Keep plans for the next run
+    if (args->wisd){
+      write_wisdom(args->wisd, xyz, nt->fft);
+    }
+
     // Over and out...
     printf("\n\n\n\t ++++ ++++ That's All Folks! ++++ ++++ \n\n\n");
+    free_filters();
+    free_pruned();
+    free_geometry();
+    stop_pool();
 
     return 0;
-    
-  } else {
-    do {
-
-      lowpass_filter(ki1, ko1, tail, xyz, nthread);
-      lowpass_filter(ki2, ko2, tail, xyz, nthread);
-
-      fftw_execute(fft_ko1_ri1);
-      fftw_execute(fft_ko2_ri2);
-
-      mean_p = truncate_map(ri1, ri2, ro1, ro2, mask, tail, args, xyz, nthread);
-
-      printf("\t Resolution = %12.6Lf | Recovery = %12.6f\n", apix / (tail->res + tail->stp), mean_p);
-      fflush(stdout);
-    
-      if (tail->prv == NULL){
-	break;
-      } else{
-	tail = tail->prv;
-      }
-
-    } while (1);
   }
 
   // Back-transform noise-suppressed maps
-  fftw_execute(fft_ro1_ki1);
-  fftw_execute(fft_ro2_ki2);
+  execute_halves(fft_ro1_ki1, fft_ro2_ki2);
 
   // Zero fill maps
-  memset(ro1, 0, r_st);
-  memset(ro2, 0, r_st);
+  zero_real(ro1, xyz, nt->real);
+  zero_real(ro2, xyz, nt->real);
 
   // Noise suppression loop 2
   printf("\n\t Reapplying spectum \n");
   printf("\n\t # Spectrum indicates the spectral power reapplied at the current resolution\n\n");
   fflush(stdout);
 
-  i = 0;
-  do {
-    if (tail->res == 0.0){
-      lowpass_filter(ki1, ko1, tail, xyz, nthread);
-      lowpass_filter(ki2, ko2, tail, xyz, nthread);
-    } else {
-      bandpass_filter(ki1, ko1, tail, xyz, nthread);
-      bandpass_filter(ki2, ko2, tail, xyz, nthread);
+  // Shells are linear in the input so all are reapplied as one radial filter
+  table = composite_filter(&head, 1, xyz);
+  for (node = &head; node; node = node->nxt){
+    printf("\t Resolution = %12.6Lf | Spectrum = %12.6Lf \n", apix / (node->res + node->stp), node->pwr);
+  }
+  fflush(stdout);
+
+  // Check composite filter against reapplying shell by shell
+  real_t *rc1 = ro1, *rc2 = ro2;
+  if (args->rchk >= 0.0){
+    for (n = 0; n < nshells; n++){
+      batch[n].fourier = nt->fourier;
+      batch[n].real = nt->real;
+    }
+    node = &head;
+    while (node){
+      for (n = 0; n < nshells && node; n++){
+        batch[n].node = node;
+        node = node->nxt;
+      }
+      reapply_shells(batch, n, ro1, ro2);
     }
+    // In place the input transforms are free to take the compact composite maps
+    rc1 = args->inpl ? (real_t *) ki1 : ri1;
+    rc2 = args->inpl ? (real_t *) ki2 : ri2;
+  }
 
-    fftw_execute(fft_ko1_ri1);
-    fftw_execute(fft_ko2_ri2);
+  filter_pair(ki1, ki2, ko1, ko2, table, 0, xyz, nt->fourier);
+  put_filter(table);
 
-    reverse_norm(ri1, ri2, ro1, ro2, mask, tail, xyz, nthread);
+  // Maps now hold data so later plans must not measure over them
+  fftw_plan_with_nthreads(split_threads(0, nt->fft));
+  fftw_plan fft_ko1_rc1 = plan_c2r(xyz, ko1, rc1, plan_effort() | FFTW_WISDOM_ONLY);
+  fftw_plan_with_nthreads(split_threads(1, nt->fft));
+  fftw_plan fft_ko2_rc2 = plan_c2r(xyz, ko2, rc2, plan_effort() | FFTW_WISDOM_ONLY);
 
-    printf("\t Resolution = %12.6Lf | Spectrum = %12.6Lf \n", apix / (tail->res + tail->stp), tail->pwr);
-    fflush(stdout);
+  execute_halves(fft_ko1_rc1, fft_ko2_rc2);
 
-    if (tail->nxt == NULL){
-      break;
-    } else{
-      tail = tail->nxt;
+  if (args->rchk >= 0.0){
+    double diff = fmax(map_difference(rc1, ro1, xyz, nt->real), map_difference(rc2, ro2, xyz, nt->real));
+    printf("\n\t Composite filter | Largest difference from shell by shell = %e (relative)\n", diff);
+    if (diff > args->rchk){
+      printf("\t Warning - composite filter differs from shell by shell reapplication by more than %e \n", args->rchk);
     }
-    
-  } while (1);
+    fflush(stdout);
+  }
 
   // Apply masks in situ
-  apply_mask(mask, ro1, nthread);
-  apply_mask(mask, ro2, nthread);
+  apply_mask(mask, ro1, nt->real);
+  apply_mask(mask, ro2, nt->real);
 
   // Output final volume
   printf("\n\t Writing noise truncated MRC files\n");
@@ -350,20 +555,18 @@ int main(int argc, char **argv){
   
   if (!args->spec){
 
-    fftw_execute(fft_ro1_ki1);
-    fftw_execute(fft_ro2_ki2);
+    execute_halves(fft_ro1_ki1, fft_ro2_ki2);
 
-    apply_spectrum(ki1, ki2, spec1, spec2, maxres, xyz, nthread);
+    apply_spectrum(ki1, ki2, spec1, spec2, maxres, xyz, nt->fourier);
 
-    fftw_plan fft_ki1_ri1 = fftw_plan_dft_c2r_3d(xyz, xyz, xyz, ki1, ri1, FFTW_ESTIMATE);
-    fftw_plan fft_ki2_ri2 = fftw_plan_dft_c2r_3d(xyz, xyz, xyz, ki2, ri2, FFTW_ESTIMATE);
+    fftw_plan_with_nthreads(split_threads(0, nt->fft));
+    fftw_plan fft_ki1_ri1 = plan_c2r(xyz, ki1, ri1, plan_effort() | FFTW_WISDOM_ONLY);
+    fftw_plan_with_nthreads(split_threads(1, nt->fft));
+    fftw_plan fft_ki2_ri2 = plan_c2r(xyz, ki2, ri2, plan_effort() | FFTW_WISDOM_ONLY);
 
-    fftw_execute(fft_ki1_ri1);
-    fftw_execute(fft_ki2_ri2);
+    execute_halves(fft_ki1_ri1, fft_ki2_ri2);
     
     // Renormalise maps
-    int32_t total = xyz * xyz * xyz;
-
     for (i = 0; i < total; i++){
       ri1[i] /= (double) total;
       ri2[i] /= (double) total;
@@ -375,8 +578,6 @@ int main(int argc, char **argv){
   } else {
 
     // Renormalise maps
-    int32_t total = xyz * xyz * xyz;
-
     for (i = 0; i < total; i++){
       ro1[i] /= (double) total;
       ro2[i] /= (double) total;
@@ -387,8 +588,17 @@ int main(int argc, char **argv){
 
   }
 
+  // Keep plans for the next run
+  if (args->wisd){
+    write_wisdom(args->wisd, xyz, nt->fft);
+  }
+
   // Over and out...
   printf("\n\n\n\t ++++ ++++ That's All Folks! ++++ ++++ \n\n\n");
+  free_filters();
+  free_pruned();
+  free_geometry();
+  stop_pool();
 
   return 0;
 }
@@ -0,0 +1,217 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Library header inclusion for linking
+#define _GNU_SOURCE
+#include "sidesplitter.h"
+#include "memory.h"
+
+// Page backing for volume buffers
+static int8_t page_mode = STANDARD_PAGES;
+
+// Select page backing for subsequent allocations
+void set_pages(int8_t mode){
+  page_mode = mode;
+  return;
+}
+
+// Inverse transforms write padded rows into their half transforms if in place
+static int8_t inplace = 0;
+
+// Select in-place inverse transforms for subsequent allocations
+void set_inplace(int8_t mode){
+  inplace = mode;
+  return;
+}
+
+int8_t inplace_layout(void){
+  return inplace;
+}
+
+// Values between rows of maps written by inverse transforms
+int32_t real_pitch(int32_t full){
+  return inplace ? 2 * (full / 2 + 1) : full;
+}
+
+// Values between consecutive maps written by inverse transforms
+int64_t real_stride(int32_t full){
+  return inplace ? 2 * fourier_stride(full) : (int64_t) full * full * full;
+}
+
+void *alloc_pages(size_t bytes){
+  void *map = NULL;
+  if (page_mode == HUGETLB_PAGES){
+    // Explicit huge pages must be reserved by the administrator
+    map = mmap(NULL, ((bytes + HUGE_PAGE - 1) / HUGE_PAGE) * HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (map != MAP_FAILED){
+      return map;
+    }
+    printf("\n\t Explicit huge pages unavailable - using transparent huge pages instead\n");
+    fflush(stdout);
+    page_mode = THP_PAGES;
+    map = NULL;
+  }
+  if (posix_memalign(&map, (page_mode == THP_PAGES) ? HUGE_PAGE : sysconf(_SC_PAGESIZE), bytes)){
+    printf("\n\t Map allocation of %zu bytes failed!\n", bytes);
+    fflush(stdout);
+    exit(1);
+  }
+#ifdef MADV_HUGEPAGE
+  if (page_mode == THP_PAGES){
+    madvise(map, bytes, MADV_HUGEPAGE);
+  }
+#endif
+  return map;
+}
+
+// Allocate real map and first touch by kernel partition
+real_t *alloc_real(int32_t full, int32_t nthreads){
+  return alloc_reals(full, 1, nthreads);
+}
+
+// Allocate half transform and first touch by kernel partition
+fftw_complex *alloc_fourier(int32_t full, int32_t nthreads){
+  return alloc_fouriers(full, 1, nthreads);
+}
+
+// Allocate consecutive real maps - each touched as a map of its own
+real_t *alloc_reals(int32_t full, int32_t count, int32_t nthreads){
+  int64_t size = (int64_t) full * full * full;
+  real_t *map = alloc_pages(count * size * sizeof(real_t));
+  for (int32_t i = 0; i < count; i++){
+    zero_real(map + i * size, full, nthreads);
+  }
+  return map;
+}
+
+// Allocate consecutive half transforms - each touched as a map of its own
+fftw_complex *alloc_fouriers(int32_t full, int32_t count, int32_t nthreads){
+  fftw_complex *map = alloc_pages(count * fourier_bytes(full));
+  for (int32_t i = 0; i < count; i++){
+    zero_fourier(map + i * fourier_stride(full), full, nthreads);
+  }
+  return map;
+}
+
+// Zero real map - blocks of voxels as in realspace kernels
+void zero_real(real_t *map, int32_t full, int32_t nthreads){
+  touch_map(map, (int64_t) full * full * full, sizeof(real_t), CACHE_LINE / sizeof(real_t), nthreads);
+  return;
+}
+
+// Zero half transform - blocks of rows as in Fourier kernels
+void zero_fourier(fftw_complex *map, int32_t full, int32_t nthreads){
+  if (split_layout()){
+    // Both planes of a row are touched by the thread that filters it
+    touch_map(map, (int64_t) full * full, (full / 2 + 1) * sizeof(real_t), 1, nthreads);
+    touch_map((real_t *) map + split_offset(full), (int64_t) full * full, (full / 2 + 1) * sizeof(real_t), 1, nthreads);
+    return;
+  }
+  touch_map(map, (int64_t) full * full, (full / 2 + 1) * sizeof(fftw_complex), 1, nthreads);
+  return;
+}
+
+void touch_map(void *map, int64_t units, size_t unit, int64_t grain, int32_t nthreads){
+  int32_t i;
+  sched work;
+  init_sched(&work, units, grain, nthreads, STATIC_SCHED);
+  touch_arg arg[nthreads];
+  // Set thread arguments
+  for (i = 0; i < nthreads; i++){
+    arg[i].map = map;
+    arg[i].unit = unit;
+    arg[i].work = &work;
+    arg[i].thread = i;
+  }
+  // Run threads on pool
+  run_pool((void*) touch_thread, arg, sizeof(arg[0]), nthreads);
+  return;
+}
+
+void touch_thread(touch_arg *arg){
+  int64_t start = -1, end = -1;
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    memset(arg->map + start * arg->unit, 0, (end - start) * arg->unit);
+  }
+  return;
+}
+
+// Report NUMA nodes holding the pages of a map
+void report_pages(char *name, void *map, size_t bytes){
+  long page = sysconf(_SC_PAGESIZE);
+  long pages = (bytes + page - 1) / page;
+  long stride = (pages + MAX_PAGE_SAMPLES - 1) / MAX_PAGE_SAMPLES;
+  long samples = (pages + stride - 1) / stride, i;
+  int32_t count[64] = {0}, missing = 0, n;
+  void **addr = malloc(samples * sizeof(void *));
+  int *status = malloc(samples * sizeof(int));
+  for (i = 0; i < samples; i++){
+    addr[i] = (char *) map + i * stride * page;
+  }
+  // Query only - no nodes requested so nothing is moved
+  if (syscall(SYS_move_pages, 0, samples, addr, NULL, status, 0)){
+    printf("\t %-6s | page placement unavailable\n", name);
+    free(addr);
+    free(status);
+    return;
+  }
+  for (i = 0; i < samples; i++){
+    if (status[i] >= 0 && status[i] < 64){
+      count[status[i]]++;
+    } else {
+      missing++;
+    }
+  }
+  printf("\t %-6s |", name);
+  for (n = 0; n < 64; n++){
+    if (count[n]){
+      printf(" node %i = %6.2f%% |", n, 100.0 * count[n] / samples);
+    }
+  }
+  if (missing){
+    printf(" unplaced = %6.2f%% |", 100.0 * missing / samples);
+  }
+  printf("\n");
+  free(addr);
+  free(status);
+  return;
+}
+
+// Report huge page use for the whole process
+void report_huge_pages(void){
+  char line[256];
+  long huge = 0, total = 0, tlb = 0, kb;
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+  if (!f){
+    return;
+  }
+  while (fgets(line, sizeof(line), f)){
+    if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1){
+      huge = kb;
+    } else if (sscanf(line, "Anonymous: %ld kB", &kb) == 1){
+      total = kb;
+    } else if (sscanf(line, "Private_Hugetlb: %ld kB", &kb) == 1){
+      tlb = kb;
+    }
+  }
+  fclose(f);
+  printf("\t Huge pages | transparent = %6.2f%% of anonymous memory | explicit = %ld MB\n", (total > 0) ? 100.0 * huge / total : 0.0, tlb / 1024);
+  return;
+}
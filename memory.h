@@ -0,0 +1,59 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Inclusions
+#include <stdio.h>
+#include <signal.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <complex.h>
+#include <fftw3.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// Huge page size assumed for alignment
+#define HUGE_PAGE (2 * 1024 * 1024)
+
+// Most pages sampled per placement report
+#define MAX_PAGE_SAMPLES 65536
+
+// First touch thread arguments structure
+typedef struct{
+  char        *map;
+  size_t      unit;
+  sched      *work;
+  int32_t   thread;
+} CACHE_ALIGN touch_arg;
+
+void *alloc_pages(size_t bytes);
+// Allocate aligned memory
+// Backed by huge pages on request
+
+void touch_map(void *map, int64_t units, size_t unit, int64_t grain, int32_t nthreads);
+// Zero map in parallel by static blocks
+
+void touch_thread(touch_arg *arg);
+// Zero own block of map
+// pthread function
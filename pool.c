@@ -0,0 +1,321 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Library header inclusion for linking
+#include "sidesplitter.h"
+#include "pool.h"
+
+// Single pool shared by all kernels and FFTW
+static pool *workers = NULL;
+
+// Optional thread groups for running the two halves at once
+static pool *groups[2] = {NULL, NULL};
+static int32_t group_size[2] = {0, 0};
+
+// Pool the calling thread should hand its jobs to
+static pthread_key_t current;
+static pthread_once_t current_once = PTHREAD_ONCE_INIT;
+
+static void make_current(void){
+  pthread_key_create(&current, NULL);
+  return;
+}
+
+// Create pool of nthreads - caller is counted as a worker
+pool *new_pool(int32_t nthreads){
+  int32_t i;
+  pool *arg;
+  if (nthreads < 2){
+    return NULL;
+  }
+  arg = calloc(1, sizeof(pool));
+  arg->nthreads = nthreads;
+  arg->threads = calloc(nthreads - 1, sizeof(pthread_t));
+  arg->ids = calloc(nthreads - 1, sizeof(pool_id));
+  pthread_mutex_init(&arg->lock, NULL);
+  pthread_cond_init(&arg->work, NULL);
+  pthread_cond_init(&arg->done, NULL);
+  // Start threads
+  for (i = 0; i < nthreads - 1; i++){
+    arg->ids[i].work = arg;
+    arg->ids[i].id = i + 1;
+    if (pthread_create(&arg->threads[i], NULL, (void*) pool_thread, &arg->ids[i])){
+      printf("\nThread initialisation failed!\n");
+      fflush(stdout);
+      exit(1);
+    }
+  }
+  return arg;
+}
+
+// Stop pool and join threads
+void free_pool(pool *arg){
+  int32_t i;
+  if (!arg){
+    return;
+  }
+  pthread_mutex_lock(&arg->lock);
+  arg->stop = 1;
+  pthread_cond_broadcast(&arg->work);
+  pthread_mutex_unlock(&arg->lock);
+  // Join threads
+  for (i = 0; i < arg->nthreads - 1; i++){
+    if (pthread_join(arg->threads[i], NULL)){
+      printf("\nThread failed during run!\n");
+      fflush(stdout);
+      exit(1);
+    }
+  }
+  pthread_mutex_destroy(&arg->lock);
+  pthread_cond_destroy(&arg->work);
+  pthread_cond_destroy(&arg->done);
+  free(arg->threads);
+  free(arg->ids);
+  free(arg);
+  return;
+}
+
+// Start persistent worker pool
+void start_pool(int32_t nthreads){
+  pthread_once(&current_once, make_current);
+  if (!workers){
+    workers = new_pool(nthreads);
+  }
+  return;
+}
+
+// Stop worker pool and any thread groups
+void stop_pool(void){
+  free_pool(groups[0]);
+  free_pool(groups[1]);
+  groups[0] = groups[1] = NULL;
+  group_size[0] = group_size[1] = 0;
+  free_pool(workers);
+  workers = NULL;
+  return;
+}
+
+// Split threads into two groups, one per half map
+int8_t split_pool(int32_t nthreads){
+  if (!workers || group_size[0] || nthreads < 2){
+    return 0;
+  }
+  // Workers 0 and 1 of the main pool lead the groups
+  group_size[0] = (nthreads + 1) / 2;
+  group_size[1] = nthreads / 2;
+  groups[0] = new_pool(group_size[0]);
+  groups[1] = new_pool(group_size[1]);
+  return 1;
+}
+
+// Threads available to half when groups are split
+int32_t split_threads(int32_t half, int32_t nthreads){
+  if (group_size[half] && group_size[half] < nthreads){
+    return group_size[half];
+  }
+  return nthreads;
+}
+
+// Run func on both halves at once - each on its own group if split
+void run_split(void *func, void *args, size_t size){
+  split_job job[2];
+  int32_t i;
+  for (i = 0; i < 2; i++){
+    job[i].func = (void (*)(void *)) func;
+    job[i].args = (char *) args + i * size;
+    job[i].half = i;
+  }
+  if (!group_size[0] || pthread_getspecific(current)){
+    // No groups, or already leading one - halves run one after the other with the threads at hand
+    for (i = 0; i < 2; i++){
+      job[i].func(job[i].args);
+    }
+    return;
+  }
+  run_pool((void*) split_thread, job, sizeof(job[0]), 2);
+  return;
+}
+
+void split_thread(split_job *arg){
+  // Restore whatever pool the worker served before
+  void *prev = pthread_getspecific(current);
+  pthread_setspecific(current, groups[arg->half]);
+  arg->func(arg->args);
+  pthread_setspecific(current, prev);
+  return;
+}
+
+// Run func on each of njobs argument structures of size bytes
+void run_pool(void *func, void *args, size_t size, int32_t njobs){
+  int32_t i;
+  int8_t busy = 1;
+  pool *arg = pthread_getspecific(current);
+  // Threads leading a half map use their own group
+  if (!arg){
+    arg = workers;
+  }
+  // Run in caller if no pool, a single job, or called from within a job
+  if (arg){
+    pthread_mutex_lock(&arg->lock);
+    busy = arg->busy;
+    arg->busy = 1;
+    pthread_mutex_unlock(&arg->lock);
+  }
+  if (busy || njobs < 2){
+    for (i = 0; i < njobs; i++){
+      ((void (*)(void *)) func)((char *) args + i * size);
+    }
+    if (!busy){
+      pthread_mutex_lock(&arg->lock);
+      arg->busy = 0;
+      pthread_mutex_unlock(&arg->lock);
+    }
+    return;
+  }
+  // Publish jobs to waiting threads
+  pthread_mutex_lock(&arg->lock);
+  arg->func = (void (*)(void *)) func;
+  arg->args = (char *) args;
+  arg->size = size;
+  arg->njobs = njobs;
+  arg->next = (njobs < arg->nthreads) ? njobs : arg->nthreads;
+  arg->pending = njobs;
+  arg->round++;
+  pthread_cond_broadcast(&arg->work);
+  pthread_mutex_unlock(&arg->lock);
+  // Take part as worker 0 then wait for stragglers
+  pool_jobs(arg, 0);
+  pthread_mutex_lock(&arg->lock);
+  while (arg->pending > 0){
+    pthread_cond_wait(&arg->done, &arg->lock);
+  }
+  arg->busy = 0;
+  pthread_mutex_unlock(&arg->lock);
+  return;
+}
+
+void pool_jobs(pool *arg, int32_t id){
+  int32_t job = id;
+  pthread_mutex_lock(&arg->lock);
+  // Job id always runs on worker id so static blocks stay put
+  if (job >= arg->njobs){
+    job = (arg->next < arg->njobs) ? arg->next++ : -1;
+  }
+  while (job >= 0){
+    pthread_mutex_unlock(&arg->lock);
+    arg->func(arg->args + job * arg->size);
+    pthread_mutex_lock(&arg->lock);
+    if (--arg->pending == 0){
+      pthread_cond_broadcast(&arg->done);
+    }
+    job = (arg->next < arg->njobs) ? arg->next++ : -1;
+  }
+  pthread_mutex_unlock(&arg->lock);
+  return;
+}
+
+void *pool_thread(pool_id *arg){
+  uint64_t round = 0;
+  pool *work = arg->work;
+  int32_t id = arg->id;
+  pthread_mutex_lock(&work->lock);
+  while (1){
+    while (work->round == round && !work->stop){
+      pthread_cond_wait(&work->work, &work->lock);
+    }
+    if (work->stop){
+      break;
+    }
+    round = work->round;
+    pthread_mutex_unlock(&work->lock);
+    pool_jobs(work, id);
+    pthread_mutex_lock(&work->lock);
+  }
+  pthread_mutex_unlock(&work->lock);
+  return NULL;
+}
+
+// Set up a work partition of size units
+void init_sched(sched *work, int64_t size, int64_t grain, int32_t nthreads, int8_t mode){
+  work->next = 0;
+  work->size = size;
+  work->grain = (grain < 1) ? 1 : grain;
+  work->nthreads = (nthreads < 1) ? 1 : nthreads;
+  work->mode = mode;
+  return;
+}
+
+// Claim next contiguous block - start and end must be -1 before the first call
+int8_t next_block(sched *work, int32_t thread, int64_t *start, int64_t *end){
+  int64_t chunk, first, left;
+  if (work->mode == STATIC_SCHED){
+    // One block per thread with boundaries on grain multiples
+    if (*start >= 0){
+      return 0;
+    }
+    chunk = (work->size + work->nthreads - 1) / work->nthreads;
+    chunk = ((chunk + work->grain - 1) / work->grain) * work->grain;
+    *start = chunk * thread;
+    *end = *start + chunk;
+  } else if (work->mode == DYNAMIC_SCHED){
+    // Fixed blocks of grain units handed out in order
+    *start = __sync_fetch_and_add(&work->next, work->grain);
+    *end = *start + work->grain;
+  } else {
+    // Guided blocks shrink with the remaining work down to grain
+    do {
+      first = work->next;
+      left = work->size - first;
+      if (left <= 0){
+        return 0;
+      }
+      chunk = left / (2 * work->nthreads);
+      chunk = ((chunk + work->grain - 1) / work->grain) * work->grain;
+      if (chunk < work->grain){
+        chunk = work->grain;
+      }
+    } while (!__sync_bool_compare_and_swap(&work->next, first, first + chunk));
+    *start = first;
+    *end = first + chunk;
+  }
+  if (*start > work->size){
+    *start = work->size;
+  }
+  if (*end > work->size){
+    *end = work->size;
+  }
+  return *end > *start;
+}
+
+#ifdef HAVE_FFTW_THREADS_CALLBACK
+void fftw_pool_loop(void *(*work)(char *), char *jobs, size_t size, int njobs, void *data){
+  (void) data;
+  run_pool((void*) work, jobs, size, (int32_t) njobs);
+  return;
+}
+#endif
+
+// Hand FFTW's parallel loops to the worker pool
+void fftw_pool(void){
+#ifdef HAVE_FFTW_THREADS_CALLBACK
+  fftw_threads_set_callback(fftw_pool_loop, NULL);
+#endif
+  return;
+}
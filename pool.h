@@ -0,0 +1,90 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Inclusions
+#include <stdio.h>
+#include <signal.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <complex.h>
+#include <fftw3.h>
+
+typedef struct pool pool;
+
+// Worker identity structure
+typedef struct{
+  pool   *work;
+  int32_t   id;
+} pool_id;
+
+// Worker pool structure
+struct pool{
+  pthread_mutex_t   lock;
+  pthread_cond_t    work;
+  pthread_cond_t    done;
+  pthread_t     *threads;
+  pool_id           *ids;
+  void         (*func)(void *);
+  char            *args;
+  size_t           size;
+  uint64_t        round;
+  int32_t         njobs;
+  int32_t          next;
+  int32_t       pending;
+  int32_t      nthreads;
+  int8_t           busy;
+  int8_t           stop;
+};
+
+// Half map job structure
+typedef struct{
+  void (*func)(void *);
+  char        *args;
+  int32_t      half;
+} split_job;
+
+pool *new_pool(int32_t nthreads);
+// Create pool of nthreads
+// NULL if fewer than two
+
+void free_pool(pool *arg);
+// Stop pool and join threads
+
+void split_thread(split_job *arg);
+// Run half map job on its group
+// pthread function
+
+void *pool_thread(pool_id *arg);
+// Wait for and run jobs
+// pthread function
+
+void pool_jobs(pool *arg, int32_t id);
+// Run own job then any that remain
+
+#ifdef HAVE_FFTW_THREADS_CALLBACK
+void fftw_pool_loop(void *(*work)(char *), char *jobs, size_t size, int njobs, void *data);
+// Run FFTW parallel loop on pool
+// FFTW callback function
+#endif
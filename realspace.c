@@ -29,47 +29,39 @@ r_mrc *make_msk(r_mrc *in, double rad, int32_t nthreads){
   double cen = (double) size / 2;
   memcpy(out, in, sizeof(r_mrc));
   out->data = calloc(size * size * size, sizeof(float));
-  pthread_t threads[nthreads];
+  sched work;
+  init_sched(&work, size * size, 1, nthreads, STATIC_SCHED);
   make_mask_arg arg[nthreads];
-  // Start threads
+  // Set thread arguments
   for (i = 0; i < nthreads; i++){
     arg[i].rad = rad * rad;
     arg[i].out = out;
     arg[i].size = size;
     arg[i].size_2 = size * size;
     arg[i].cen = cen;
-    arg[i].step = nthreads;
+    arg[i].work = &work;
     arg[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) make_mask_thread, &arg[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
-  }
-  // Join threads
-  for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
-    }
   }
+  // Run threads on pool
+  run_pool((void*) make_mask_thread, arg, sizeof(arg[0]), nthreads);
   return out;
 }
 
 void make_mask_thread(make_mask_arg *arg){
   double i, j, k, norm;
-  for(int32_t _k = 0; _k < arg->size; _k++){
-    k = (double) _k - arg->cen;
-    k = k * k;
-    for(int32_t _j = 0; _j < arg->size; _j++){
-      j = (double) _j - arg->cen;
+  int64_t row, start = -1, end = -1;
+  // Blocks are whole rows of the map
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for(row = start; row < end; row++){
+      k = (double) (row / arg->size) - arg->cen;
+      k = k * k;
+      j = (double) (row % arg->size) - arg->cen;
       j = j * j;
-      for(int32_t _i = arg->thread; _i < arg->size; _i += arg->step){
+      for(int32_t _i = 0; _i < arg->size; _i++){
         i = (double) _i - arg->cen;
         i = i * i;
         norm = (double) k + j + i;
-        arg->out->data[ _k * arg->size_2 + _j * arg->size + _i ] = 1.0 / sqrt(1.0 + pow((norm / arg->rad), 8.0));
+        arg->out->data[ row * arg->size + _i ] = 1.0 / sqrt(1.0 + pow((norm / arg->rad), 8.0));
       }
     }
   }
@@ -77,75 +69,99 @@ void make_mask_thread(make_mask_arg *arg){
 }
 
 // Add MRC map in to out
-void add_map(r_mrc *in, double *out, int32_t nthreads){
+void add_map(r_mrc *in, real_t *out, int32_t nthreads){
   int32_t size = in->n_crs[0] * in->n_crs[1] * in->n_crs[2], i;
-  pthread_t threads[nthreads];
+  sched work;
+  init_sched(&work, size, CACHE_LINE / sizeof(real_t), nthreads, STATIC_SCHED);
   map_arg arg[nthreads];
-  // Start threads
+  // Set thread arguments
   for (i = 0; i < nthreads; i++){
     arg[i].in = in;
     arg[i].out = out;
-    arg[i].size = size;
-    arg[i].step = nthreads;
+    arg[i].work = &work;
     arg[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) add_map_thread, &arg[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
-  }
-  // Join threads
-  for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
-    }
   }
+  // Run threads on pool
+  run_pool((void*) add_map_thread, arg, sizeof(arg[0]), nthreads);
   return;
 }
 
 void add_map_thread(map_arg *arg){
-  int32_t i;
-  for (i = arg->thread; i < arg->size; i += arg->step){
-    arg->out[i] += (double) arg->in->data[i];
+  int64_t i, start = -1, end = -1;
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for (i = start; i < end; i++){
+      arg->out[i] += (real_t) arg->in->data[i];
+    }
   }
   return;
 }
 
 // Multiply out by in elementwise
-void apply_mask(r_mrc *in, double *out, int32_t nthreads){
+void apply_mask(r_mrc *in, real_t *out, int32_t nthreads){
   int32_t size = in->n_crs[0] * in->n_crs[1] * in->n_crs[2], i;
-  pthread_t threads[nthreads];
+  sched work;
+  init_sched(&work, size, CACHE_LINE / sizeof(real_t), nthreads, STATIC_SCHED);
   map_arg arg[nthreads];
-  // Start threads
+  // Set thread arguments
   for (i = 0; i < nthreads; i++){
     arg[i].in = in;
     arg[i].out = out;
-    arg[i].size = size;
-    arg[i].step = nthreads;
+    arg[i].work = &work;
     arg[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) apply_mask_thread, &arg[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
   }
-  // Join threads
-  for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
+  // Run threads on pool
+  run_pool((void*) apply_mask_thread, arg, sizeof(arg[0]), nthreads);
+  return;
+}
+
+void apply_mask_thread(map_arg *arg){
+  int64_t i, start = -1, end = -1;
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for (i = start; i < end; i++){
+      arg->out[i] *= (real_t) arg->in->data[i];
     }
   }
   return;
 }
 
-void apply_mask_thread(map_arg *arg){
+// Largest difference between maps relative to largest magnitude of map2
+double map_difference(real_t *map1, real_t *map2, int32_t size, int32_t nthreads){
+  int64_t max = (int64_t) size * size * size;
   int32_t i;
-  for (i = arg->thread; i < arg->size; i += arg->step){
-    arg->out[i] *= (double) arg->in->data[i];
+  double diff = 0.0, peak = 0.0;
+  sched work;
+  init_sched(&work, max, CACHE_LINE / sizeof(real_t), nthreads, STATIC_SCHED);
+  diff_arg arg[nthreads];
+  // Set thread arguments
+  for (i = 0; i < nthreads; i++){
+    arg[i].map1 = map1;
+    arg[i].map2 = map2;
+    arg[i].diff = 0.0;
+    arg[i].peak = 0.0;
+    arg[i].work = &work;
+    arg[i].thread = i;
+  }
+  // Run threads on pool
+  run_pool((void*) map_difference_thread, arg, sizeof(arg[0]), nthreads);
+  // Merge thread results
+  for (i = 0; i < nthreads; i++){
+    diff = (arg[i].diff > diff) ? arg[i].diff : diff;
+    peak = (arg[i].peak > peak) ? arg[i].peak : peak;
+  }
+  return (peak > 0.0) ? diff / peak : diff;
+}
+
+void map_difference_thread(diff_arg *arg){
+  int64_t i, start = -1, end = -1;
+  double diff = 0.0, peak = 0.0;
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for (i = start; i < end; i++){
+      diff = fmax(diff, fabs(arg->map1[i] - arg->map2[i]));
+      peak = fmax(peak, fabs(arg->map2[i]));
+    }
   }
+  // Write back once per thread
+  arg->diff = diff;
+  arg->peak = peak;
   return;
 }
@@ -34,11 +34,10 @@
 // Filter map thread arguments structure
 typedef struct{
   r_mrc      *in;
-  double    *out;
-  int32_t   size;
-  int32_t   step;
+  real_t    *out;
+  sched    *work;
   int32_t thread;
-} map_arg;
+} CACHE_ALIGN map_arg;
 
 // Mask making thread argument structure
 typedef struct{
@@ -47,9 +46,19 @@ typedef struct{
   double     cen;
   int32_t   size;
   int32_t size_2;
-  int32_t   step;
+  sched    *work;
+  int32_t thread;
+} CACHE_ALIGN make_mask_arg;
+
+// Map difference thread arguments structure
+typedef struct{
+  real_t   *map1;
+  real_t   *map2;
+  double    diff;
+  double    peak;
+  sched    *work;
   int32_t thread;
-} make_mask_arg;
+} CACHE_ALIGN diff_arg;
 
 void make_mask_thread(make_mask_arg *arg);
 // Make mask at diameter
@@ -62,3 +71,7 @@ void add_map_thread(map_arg *arg);
 void apply_mask_thread(map_arg *arg);
 // Multiply out by in elementwise
 // pthread function
+
+void map_difference_thread(diff_arg *arg);
+// Largest difference and magnitude
+// pthread function
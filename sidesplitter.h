@@ -37,15 +37,113 @@
 #define DEBUG
 #endif
 
+// Per-thread data is padded to whole cache lines
+#define CACHE_LINE 64
+#define CACHE_ALIGN __attribute__((aligned(CACHE_LINE)))
+
+// Page backing for volume buffers
+#define STANDARD_PAGES 0
+#define THP_PAGES      1
+#define HUGETLB_PAGES  2
+
+// Most pass 2 and 3 shells filtered together
+#define SHELL_BATCH 8
+
+// Fourier kernel instruction sets
+#define SIMD_SCALAR 0
+#define SIMD_SSE2   1
+#define SIMD_AVX2   2
+#define SIMD_AVX512 3
+#define SIMD_AUTO   4
+
+// Reductions run in short plain blocks over lanes then fold into compensated sums
+#define REDUCE_LANES 4
+#define REDUCE_BLOCK 256
+
+// Maps, transforms and Fourier kernels run in float if built with SINGLE_PRECISION
+// Filters, spectra and reductions stay in double either way
+#ifdef SINGLE_PRECISION
+typedef float real_t;
+#define fftw_complex fftwf_complex
+#define fftw_plan fftwf_plan
+#define fftw_iodim fftwf_iodim
+#define fftw_malloc fftwf_malloc
+#define fftw_free fftwf_free
+#define fftw_execute fftwf_execute
+#define fftw_destroy_plan fftwf_destroy_plan
+#define fftw_plan_dft_r2c_3d fftwf_plan_dft_r2c_3d
+#define fftw_plan_dft_c2r_3d fftwf_plan_dft_c2r_3d
+#define fftw_plan_many_dft_c2r fftwf_plan_many_dft_c2r
+#define fftw_plan_guru_dft fftwf_plan_guru_dft
+#define fftw_plan_guru_dft_c2r fftwf_plan_guru_dft_c2r
+#define fftw_plan_guru_split_dft_r2c fftwf_plan_guru_split_dft_r2c
+#define fftw_plan_guru_split_dft_c2r fftwf_plan_guru_split_dft_c2r
+#define fftw_plan_with_nthreads fftwf_plan_with_nthreads
+#define fftw_init_threads fftwf_init_threads
+#define fftw_threads_set_callback fftwf_threads_set_callback
+#define fftw_forget_wisdom fftwf_forget_wisdom
+#define fftw_export_wisdom_to_string fftwf_export_wisdom_to_string
+#define fftw_import_wisdom_from_string fftwf_import_wisdom_from_string
+#define PRECISION_NAME "single"
+#else
+typedef double real_t;
+#define PRECISION_NAME "double"
+#endif
+
+// Work partition schedules
+#define STATIC_SCHED  0
+#define DYNAMIC_SCHED 1
+#define GUIDED_SCHED  2
+
+// Work partition
+typedef struct{
+  int64_t      next;
+  int64_t      size;
+  int64_t     grain;
+  int32_t  nthreads;
+  int8_t       mode;
+} CACHE_ALIGN sched;
+
 // Arguments
 typedef struct {
   char   *vol1;
   char   *vol2;
   char   *mask;
+  char   *prof;
+  char   *wisd;
+  char    *wsz;
+  double   tol;
+  double   eps;
+  double   chk;
+  double  rchk;
   int8_t  spec;
   int8_t  rotf;
+  int8_t  page;
+  int8_t  numa;
+  int8_t  tune;
+  int8_t  half;
+  int8_t  look;
+  int8_t  fscp;
+  int8_t  simd;
+  int8_t  soa;
+  int8_t  bench;
+  int8_t  batch;
+  int8_t  rnrm;
+  int8_t  pars;
+  int8_t  schk;
+  int8_t  inpl;
+  int8_t  prun;
+  int8_t  crs;
+  int32_t plan;
 } arguments;
 
+// Thread counts per stage
+typedef struct {
+  int32_t     fft;
+  int32_t fourier;
+  int32_t    real;
+} jobs;
+
 // List node
 typedef struct list list;
 struct list {
@@ -83,6 +181,114 @@ typedef struct {
   float  *data;
 } r_mrc;
 
+// Fourier-space geometry
+typedef struct {
+  uint32_t    *r2;
+  uint16_t *shell;
+  uint32_t   edge;
+  int32_t    full;
+  int32_t    size;
+} geom;
+
+// Filter table and squared radius band it covers
+typedef struct {
+  double *table;
+  uint32_t   lo;
+  uint32_t   hi;
+} filter;
+
+// Compensated double sum - err holds the low order bits lost from sum
+typedef struct {
+  double sum;
+  double err;
+} csum;
+
+// Cross and power spectra by squared radius
+// Whole-sphere difference and sum power if requested
+typedef struct {
+  csum    *nom;
+  csum    *dn1;
+  csum    *dn2;
+  csum    *dif;
+  csum    *sum;
+  int32_t radii;
+} profile;
+
+// Coarse box maps and plans of a pass 1 shell - plans by box size
+typedef struct {
+  fftw_complex  *k1;
+  fftw_complex  *k2;
+  real_t        *r1;
+  real_t        *r2;
+  fftw_plan  *plan1;
+  fftw_plan  *plan2;
+  int32_t  threads;
+} coarse;
+
+// Pass 2 shell maps and plans
+typedef struct {
+  list         *node;
+  fftw_complex  *ki1;
+  fftw_complex  *ki2;
+  fftw_complex  *pk1;
+  fftw_complex  *pk2;
+  fftw_complex  *ko1;
+  fftw_complex  *ko2;
+  fftw_complex *oko1;
+  fftw_complex *oko2;
+  real_t        *ri1;
+  real_t        *ri2;
+  real_t       *ori1;
+  real_t       *ori2;
+  fftw_plan     fft1;
+  fftw_plan     fft2;
+  fftw_plan     fft3;
+  fftw_plan     fft4;
+  fftw_plan    rest1;
+  fftw_plan    rest2;
+  fftw_plan    rest3;
+  fftw_plan    rest4;
+  r_mrc        *mask;
+  profile      *prof;
+  coarse        *crs;
+  double       check;
+  double       worst;
+  double        apix;
+  double       noise;
+  double       count;
+  int32_t       ring;
+  int32_t       rest;
+  int8_t       whole;
+  int8_t      inside;
+  int32_t       grid;
+  int32_t       size;
+  int32_t    fourier;
+  int32_t       real;
+} shell;
+
+
+/* Compensated summation */
+
+// Add x to acc - the rounding error of each add is exact and kept in err
+static inline void add_sum(csum *acc, double x){
+  double t = acc->sum + x;
+  double z = t - acc->sum;
+  acc->err += (acc->sum - (t - z)) + (x - z);
+  acc->sum = t;
+  return;
+}
+
+// Fold partial sum part into acc
+static inline void merge_sum(csum *acc, csum *part){
+  add_sum(acc, part->sum);
+  acc->err += part->err;
+  return;
+}
+
+static inline double get_sum(csum *acc){
+  return acc->sum + acc->err;
+}
+
 
 /* Function definitions */
 
@@ -92,6 +298,66 @@ arguments *parse_args(int argc, char **argv);
 
 int get_num_jobs();
 // Returns number of processors
+// Limited by affinity and cgroup quota
+
+int cgroup_cpus(void);
+// Returns cgroup CPU quota
+// Zero if unlimited
+
+jobs *stage_jobs(arguments *args, r_mrc *mask, int32_t full, int32_t nthreads);
+// Thread counts for FFT, Fourier and real-space stages
+// From autotuning, saved profile, or all threads
+
+int8_t read_wisdom(char *store, int32_t full, int32_t nthreads);
+// Import stored FFTW wisdom for box, thread count, precision and CPU
+// Returns 1 if found
+
+void write_wisdom(char *store, int32_t full, int32_t nthreads);
+// Replace stored wisdom for box, thread count, precision and CPU
+// Other sections are kept - rewritten under a lock file only if the wisdom changed
+
+void make_wisdom(arguments *args, int32_t nthreads);
+// Plan transforms for each listed box size and store wisdom
+
+void bench_layout(int8_t split, jobs *stage, int32_t full);
+// Time Fourier kernels and FFT in both storage layouts
+// Restores split layout on return
+
+void check_sums(fftw_complex *half1, fftw_complex *half2, real_t *map1, real_t *map2, r_mrc *mask, jobs *stage, int32_t full);
+// Report relative errors of FSC, spectrum and power reductions
+// Against compensated long double, with plain long double alongside
+
+void start_pool(int32_t nthreads);
+// Start persistent worker threads
+
+void run_pool(void *func, void *args, size_t size, int32_t njobs);
+// Run func over njobs argument structures
+// Returns once all jobs are complete
+
+void stop_pool(void);
+// Stop and join worker threads
+
+void fftw_pool(void);
+// Run FFTW threads on worker pool
+
+void init_sched(sched *work, int64_t size, int64_t grain, int32_t nthreads, int8_t mode);
+// Partition size units between threads
+// Static blocks are aligned to grain
+
+int8_t next_block(sched *work, int32_t thread, int64_t *start, int64_t *end);
+// Claim next contiguous block [start, end)
+// Start and end must be -1 on first call
+
+int8_t split_pool(int32_t nthreads);
+// Split threads into two groups
+// Returns 1 if half maps will run concurrently
+
+int32_t split_threads(int32_t half, int32_t nthreads);
+// Returns threads available to half
+
+void run_split(void *func, void *args, size_t size);
+// Run func on both halves at once
+// Serial if groups are not split or the caller already leads one
 
 list *extend_list(list *node, double p);
 // Extend list by one using p-val
@@ -100,10 +366,54 @@ list *extend_list(list *node, double p);
 list *end_list(list *node);
 // Finish list to 0.5 for overfit calculation
 
+void set_pages(int8_t mode);
+// Select page backing for new maps
+
+void set_inplace(int8_t mode);
+// Select in-place inverse transforms
+// Real maps then share the buffer of their half transform
+
+int8_t inplace_layout(void);
+// Returns 1 if inverse transforms run in place
+
+int32_t real_pitch(int32_t full);
+// Values between rows of inverse transformed maps
+// Rows are padded to 2 * (full / 2 + 1) if in place
+
+int64_t real_stride(int32_t full);
+// Values between consecutive inverse transformed maps
+
+real_t *alloc_real(int32_t full, int32_t nthreads);
+// Allocate zeroed real map
+// Pages first touched by kernel partition
+
+fftw_complex *alloc_fourier(int32_t full, int32_t nthreads);
+// Allocate zeroed half transform
+// Pages first touched by kernel partition
+
+real_t *alloc_reals(int32_t full, int32_t count, int32_t nthreads);
+// Allocate count consecutive zeroed real maps
+
+fftw_complex *alloc_fouriers(int32_t full, int32_t count, int32_t nthreads);
+// Allocate count consecutive zeroed half transforms
+// Spaced fourier_stride coefficients apart
+
+void zero_real(real_t *map, int32_t full, int32_t nthreads);
+// Zero real map in parallel
+
+void zero_fourier(fftw_complex *map, int32_t full, int32_t nthreads);
+// Zero half transform in parallel
+
+void report_pages(char *name, void *map, size_t bytes);
+// Print NUMA nodes holding map pages
+
+void report_huge_pages(void);
+// Print huge page use of process
+
 r_mrc *read_mrc(char* filename);
 // Read mrc file and build struct
 
-void write_mrc(r_mrc *mrc, double *map, char* filename, int32_t size);
+void write_mrc(r_mrc *mrc, real_t *map, char* filename, int32_t size);
 // Read mrc file and build struct
 
 void strip_ext(char *fname);
@@ -112,21 +422,108 @@ void strip_ext(char *fname);
 r_mrc *make_msk(r_mrc *mrc, double rad, int32_t nthread);
 // Make mask from radius in voxels
 
-void add_map(r_mrc *in, double *out, int32_t nthread);
+void add_map(r_mrc *in, real_t *out, int32_t nthread);
 // Add MRC map in to out
 
+geom *get_geometry(int32_t full, int32_t nthread);
+// Squared radius and shell of each Fourier voxel
+// Built once and kept while the box size is unchanged
+
+void row_band(geom *geo, int64_t row, uint32_t lo, uint32_t hi, int32_t *first, int32_t *last);
+// Column range [first, last) of row with squared radius in [lo, hi]
+
+int32_t band_radius(uint32_t hi);
+// Largest whole radius within squared radius hi
+
+void free_geometry(void);
+// Release cached geometry
+
+filter *get_filter(int32_t full, double hires, double lores);
+// Butterworth table indexed by squared radius
+// Lowpass if lores is negative - release with put_filter
+
+void put_filter(filter *table);
+// Release table from get_filter
+
+void set_filter_eps(double eps);
+// Skip coefficients with filter weight at most eps
+// Negative visits every coefficient
+
+void free_filters(void);
+// Release all banked filter tables
+
+int8_t best_kernels(void);
+// Widest kernel instruction set the CPU supports
+
+void set_kernels(int8_t mode);
+// Select Fourier kernels by instruction set
+// SIMD_AUTO picks the widest supported
+
+void set_layout(int8_t mode, int32_t full);
+// Store half transforms of box full interleaved or split
+// Split keeps real and imaginary parts in separate planes
+
+int8_t split_layout(void);
+// Returns 1 if half transforms are split
+
+int64_t split_offset(int32_t full);
+// Offset of imaginary plane in split half transforms
+
+size_t fourier_bytes(int32_t full);
+// Bytes of half transform in current layout
+
+int64_t fourier_stride(int32_t full);
+// Coefficients between consecutive half transforms
+
+fftw_complex get_coef(fftw_complex *map, int64_t index);
+// Read coefficient index of half transform
+
+void set_coef(fftw_complex *map, int64_t index, fftw_complex value);
+// Write coefficient index of half transform
+
+void zero_row(fftw_complex *map, int64_t index, int64_t n);
+// Zero n coefficients from index
+
+void scale_row(fftw_complex *in, fftw_complex *out, double *table, uint32_t *r2, int64_t index, int64_t n);
+// Scale n coefficients from index by table gathered at r2
+
+void pair_row(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, double *table, uint32_t *r2, int64_t index, int64_t n, csum *sums);
+// Scale both halves by table gathered at r2
+// Adds cross and power sums to sums if not NULL
+
+void corr_row(fftw_complex *in1, fftw_complex *in2, int64_t index, int64_t n, csum *sums);
+// Add cross and power sums of n coefficients to sums
+
+void add_row(fftw_complex *in, fftw_complex *out, int64_t index, int64_t n);
+// Add n coefficients of in to out
+
+void spectra_row(fftw_complex *in1, fftw_complex *in2, uint16_t *shell, int64_t index, int64_t n, csum *out1, csum *out2, csum *nom, csum *dn1, csum *dn2, int32_t *count);
+// Add amplitudes and counts of n coefficients by shell
+// Cross and power sums too if nom is not NULL
+
+void shells_row(fftw_complex *in1, fftw_complex *in2, double *w1, double *w2, uint16_t *shell, int64_t index, int64_t n);
+// Scale both halves in place by weights gathered at shell
+
+void apply_filter(fftw_complex *in, fftw_complex *out, filter *table, int32_t size, int32_t nthread);
+// Multiply in by table gathered by squared radius into out
+// Zero outside the band
+
 void add_fft(fftw_complex *in, fftw_complex *out, int32_t size, int32_t nthread);
 // Add FFT in to out
 
-double get_spectrum(fftw_complex *half1, fftw_complex *half2, long double *spec1, long double *spec2, int32_t full, int32_t nthreads);
+double get_spectrum(fftw_complex *half1, fftw_complex *half2, double *spec1, double *spec2, int32_t full, int32_t nthreads);
 // Get spectra for halves
 
-void apply_spectrum(fftw_complex *half1, fftw_complex *half2, long double *spec1, long double *spec2, double cutoff, int32_t full, int32_t nthreads);
+void apply_spectrum(fftw_complex *half1, fftw_complex *half2, double *spec1, double *spec2, double cutoff, int32_t full, int32_t nthreads);
 // Reapply spectra to halves
 
-void apply_mask(r_mrc *in, double *out, int32_t nthread);
+void apply_mask(r_mrc *in, real_t *out, int32_t nthread);
 // Multiply out by in elementwise
 
+double map_difference(real_t *map1, real_t *map2, int32_t size, int32_t nthread);
+// Largest difference between maps
+// Relative to largest magnitude in map2
+
 void bandpass_filter(fftw_complex *in, fftw_complex *out, list *node, int32_t size, int32_t nthread);
 // Apply bandpass to in and writes to out
 // List node specifies resolutions
@@ -135,21 +532,154 @@ void lowpass_filter(fftw_complex *in, fftw_complex *out, list *node, int32_t siz
 // Butterworth lowpass from in to out
 // List node specifies resolution
 
+void set_plan_effort(unsigned flags);
+// Set FFTW planner effort
+
+unsigned plan_effort(void);
+// Returns FFTW planner effort
+
+fftw_plan plan_r2c(int32_t full, real_t *in, fftw_complex *out, unsigned flags);
+// Plan forward transform into half transform layout
+// Falls back to an estimate if wisdom only finds none
+
+fftw_plan plan_c2r(int32_t full, fftw_complex *in, real_t *out, unsigned flags);
+// Plan inverse transform from half transform layout
+
+fftw_plan plan_c2r_many(int32_t full, int32_t count, fftw_complex *in, real_t *out, unsigned flags);
+// Plan inverse transforms of count consecutive half transforms
+// In place if out is in - maps are then padded as the transforms
+
+void execute_halves(fftw_plan plan1, fftw_plan plan2);
+// Execute both half map plans on their groups
+
+void set_pruning(int8_t mode, r_mrc *mask);
+// Enable pruned inverse transforms and note the sections and rows the mask touches
+
+void prune_plan(fftw_plan plan, fftw_complex *in, real_t *out, int32_t full, int32_t nthreads);
+// Let an inverse plan run pruned to the band of its filter
+// Ignored unless pruning is enabled in interleaved storage
+
+void execute_pruned(fftw_plan plan, uint32_t hi, int8_t inside);
+// Execute inverse plan skipping columns beyond squared radius hi
+// Only real rows through the mask are transformed if inside is set
+
+void execute_band(fftw_plan plan1, fftw_plan plan2, uint32_t hi, int8_t inside);
+// Execute both half map plans pruned to the band on their groups
+// Falls back to execute_halves if either runs whole
+
+void free_pruned(void);
+// Destroy pruned passes
+
+void lock_planner(void);
+// Hold the FFTW planner while planning during a pass
+
+void unlock_planner(void);
+// Release the FFTW planner
+
+double bandpass_pair(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, list *node, int32_t size, int32_t nthread);
+// Bandpass both halves in one sweep
+// Returns FSC between filtered halves
+
+double lowpass_pair(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, list *node, int8_t corr, int32_t size, int32_t nthread);
+// Lowpass both halves in one sweep
+// Returns FSC if corr is set
+
+double filter_pair(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, filter *table, int8_t corr, int32_t size, int32_t nthread);
+// Apply table to both halves in one sweep
+// Returns FSC over the band if corr is set
+
+void filter_batch(fftw_complex *in1, fftw_complex *in2, fftw_complex **out1, fftw_complex **out2, filter **table, int32_t count, int32_t size, int32_t nthread);
+// Apply count tables to both halves in one sweep
+// Each input row is read once for all outputs
+
+profile *get_profile(fftw_complex *half1, fftw_complex *half2, int8_t whole, int32_t size, int32_t nthread);
+// Radial cross and power spectra by squared radius
+// Whole-sphere difference and sum power too if whole is set
+
+double profile_fsc(profile *prof, filter *table);
+// FSC between halves after filtering by table
+// Sum over radii in the band of the table
+
+void free_profile(profile *prof);
+// Release radial profile
+
+double calc_fsc_band(fftw_complex *half1, fftw_complex *half2, uint32_t lo, uint32_t hi, int32_t size, int32_t nthread);
+// Calculate FSC over squared radii lo to hi
+// Returns FSC
+
 double calc_fsc(fftw_complex *half1, fftw_complex *half2, int32_t size, int32_t nthread);
 // Calculate FSC over map
 // Returns FSC
 
-double normalise(double *in1, double *in2, double *out1, double *out2, r_mrc *mask, list *node, int32_t size, int32_t nthread);
+double normalise(real_t *in1, real_t *in2, real_t *out1, real_t *out2, r_mrc *mask, list *node, int32_t size, int32_t pitch, int32_t nthread);
 // Suppress noise between in/out
 // Returns mean p-val in mask
+// Statistics only if out1 is NULL - inputs have rows pitch values apart
+
+double profile_norm(profile *prof, list *node, int32_t size);
+// Whole-box noise and power of shell by Parseval
+// Returns mean p-val over the box
 
-void reverse_norm(double *in1, double *in2, double *out1, double *out2, r_mrc *mask, list *node, int32_t size, int32_t nthread);
+void filter_shell(shell *arg);
+// Filter both halves to the shell at node
+// Sets FSC and transforms to real space - on its coarse box if it has one
+
+double pass_ahead(shell *batch, real_t *out1, real_t *out2, int8_t ready);
+// Normalise first shell into out
+// Filters second shell meanwhile if it has a node
+
+void reverse_norm(real_t *in1, real_t *in2, real_t *out1, real_t *out2, r_mrc *mask, list *node, int32_t size, int32_t nthread);
 // Revert normalised data
 
-double truncate_map(double *in1, double *in2, double *out1, double *out2, r_mrc *mask, list *node, arguments *args, int32_t size, int32_t nthread);
-// Updates out if in1/2 over noise
-// Returns fractional recovery
+filter *composite_filter(list *head, int8_t revert, int32_t full);
+// Sum of shell filters weighted by step over power
+// Power over step if revert - release with put_filter
+
+void reapply_shells(shell *batch, int32_t nshells, real_t *out1, real_t *out2);
+// Bandpass, transform and revert shells into out
+// Ring shells are filtered in one sweep
+
+void run_shells(shell *batch, int32_t nshells);
+// Lowpass, transform and threshold shells
+// Two shells run at once on split groups
+// Ring shells are filtered in one sweep
+
+void alloc_ring(shell *batch, int32_t nshells, int32_t rest, int8_t taper, int32_t fft_threads);
+// Point shells into consecutive maps of the first
+// Plans transform all shells at once - or the first rest for a short last batch
+
+void alloc_shell(shell *arg, int8_t taper, int32_t fft_threads);
+// Allocate missing shell maps and plans
+
+double shell_noise(real_t *in1, real_t *in2, r_mrc *mask, double *count, int32_t size, int32_t nthread);
+// Normalise in1/2 and return noise threshold
+// Count returns voxels within mask
+
+void first_crossing(shell *batch, int32_t nshells, uint16_t base, real_t *out1, real_t *out2, uint16_t *first1, uint16_t *first2, double *hits, int8_t taper, int32_t size, int32_t nthread);
+// Record first shell each voxel is over noise
+// Hits returns voxels recovered per shell
+
+void set_coarse(r_mrc *mask, fftw_complex *k, real_t *r, int32_t full, int32_t nthreads);
+// Crop the spectrum of the mask for pass 1 shells on coarse boxes
+// Uses k and r as scratch - they must hold no data
+
+int32_t coarse_size(uint32_t hi);
+// Coarse box for a band within squared radius hi
+// Returns 0 if the shell must run on the full box
+
+void alloc_coarse(shell *arg, int32_t fft_threads);
+// Allocate coarse maps for the largest coarse box
+
+int32_t coarse_shell(shell *arg, uint32_t hi);
+// Crop and transform the filtered halves on their coarse box
+// Returns the box or 0 if it ran on none
+
+double coarse_norm(shell *arg);
+// Noise and power of shell over the mask from its coarse box
+// Returns mean p-val in mask
+
+void free_coarse(shell *arg);
+// Release coarse maps and plans of shell
 
-double taper_map(double *in1, double *in2, double *out1, double *out2, double *ori1, double *ori2, r_mrc *mask, list *node, arguments *args, int32_t size, int32_t nthread);
-// Updates out if in1/2 over noise
-// Returns fractional recovery
+void free_coarse_masks(void);
+// Release the mask spectrum and weights
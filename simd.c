@@ -0,0 +1,1053 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+// Library header inclusion for linking
+#include "sidesplitter.h"
+#include "simd.h"
+
+// Selected instruction set and storage
+static int8_t kernel_set = SIMD_SCALAR;
+static int8_t split = 0;
+
+// Offset of imaginary plane in split storage
+static int64_t plane = 0;
+
+/* Scalar kernels - reference arithmetic and tails of vector loops */
+
+static void scale_scalar(fftw_complex *in, fftw_complex *out, double *table, uint32_t *r2, int64_t index, int64_t n){
+  for (int64_t i = index; i < index + n; i++){
+    out[i] = in[i] * table[r2[i]];
+  }
+  return;
+}
+
+static void pair_scalar(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, double *table, uint32_t *r2, int64_t index, int64_t n, csum *sums){
+  fftw_complex f1, f2;
+  double w;
+  int64_t i;
+  if (!sums){
+    for (i = index; i < index + n; i++){
+      w = table[r2[i]];
+      out1[i] = in1[i] * w;
+      out2[i] = in2[i] * w;
+    }
+    return;
+  }
+  // Row sums are short - fold each into the compensated sums
+  double numerator = 0.0, denomin_1 = 0.0, denomin_2 = 0.0;
+  for (i = index; i < index + n; i++){
+    w = table[r2[i]];
+    f1 = in1[i] * w;
+    f2 = in2[i] * w;
+    out1[i] = f1;
+    out2[i] = f2;
+    numerator += creal(f1 * conj(f2));
+    denomin_1 += creal(f1 * conj(f1));
+    denomin_2 += creal(f2 * conj(f2));
+  }
+  add_sum(&sums[0], numerator);
+  add_sum(&sums[1], denomin_1);
+  add_sum(&sums[2], denomin_2);
+  return;
+}
+
+static void corr_scalar(fftw_complex *in1, fftw_complex *in2, int64_t index, int64_t n, csum *sums){
+  double numerator = 0.0, denomin_1 = 0.0, denomin_2 = 0.0;
+  for (int64_t i = index; i < index + n; i++){
+    numerator += creal(in1[i] * conj(in2[i]));
+    denomin_1 += creal(in1[i] * conj(in1[i]));
+    denomin_2 += creal(in2[i] * conj(in2[i]));
+  }
+  add_sum(&sums[0], numerator);
+  add_sum(&sums[1], denomin_1);
+  add_sum(&sums[2], denomin_2);
+  return;
+}
+
+static void add_scalar(fftw_complex *in, fftw_complex *out, int64_t index, int64_t n){
+  for (int64_t i = index; i < index + n; i++){
+    out[i] += in[i];
+  }
+  return;
+}
+
+static void spectra_scalar(fftw_complex *in1, fftw_complex *in2, uint16_t *shell, int64_t index, int64_t n, csum *out1, csum *out2, csum *nom, csum *dn1, csum *dn2, int32_t *count){
+  int32_t norms;
+  for (int64_t i = index; i < index + n; i++){
+    norms = shell[i];
+    add_sum(&out1[norms], sqrt(fabs(creal(in1[i] * conj(in1[i])))));
+    add_sum(&out2[norms], sqrt(fabs(creal(in2[i] * conj(in2[i])))));
+    if (nom){
+      add_sum(&nom[norms], creal(in1[i] * conj(in2[i])));
+      add_sum(&dn1[norms], creal(in1[i] * conj(in1[i])));
+      add_sum(&dn2[norms], creal(in2[i] * conj(in2[i])));
+    }
+    count[norms]++;
+  }
+  return;
+}
+
+static void shells_scalar(fftw_complex *in1, fftw_complex *in2, double *w1, double *w2, uint16_t *shell, int64_t index, int64_t n){
+  for (int64_t i = index; i < index + n; i++){
+    in1[i] *= w1[shell[i]];
+    in2[i] *= w2[shell[i]];
+  }
+  return;
+}
+
+/* Scalar kernels on split storage - real part at i and imaginary part at plane + i */
+
+static void scale_split_scalar(fftw_complex *in, fftw_complex *out, double *table, uint32_t *r2, int64_t index, int64_t n){
+  real_t *x = (real_t *) in, *y = (real_t *) out;
+  double w;
+  for (int64_t i = index; i < index + n; i++){
+    w = table[r2[i]];
+    y[i] = x[i] * w;
+    y[plane + i] = x[plane + i] * w;
+  }
+  return;
+}
+
+static void pair_split_scalar(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, double *table, uint32_t *r2, int64_t index, int64_t n, csum *sums){
+  real_t *x1 = (real_t *) in1, *x2 = (real_t *) in2, *y1 = (real_t *) out1, *y2 = (real_t *) out2;
+  double w, a1, b1, a2, b2;
+  int64_t i;
+  if (!sums){
+    for (i = index; i < index + n; i++){
+      w = table[r2[i]];
+      y1[i] = x1[i] * w;
+      y1[plane + i] = x1[plane + i] * w;
+      y2[i] = x2[i] * w;
+      y2[plane + i] = x2[plane + i] * w;
+    }
+    return;
+  }
+  double numerator = 0.0, denomin_1 = 0.0, denomin_2 = 0.0;
+  for (i = index; i < index + n; i++){
+    w = table[r2[i]];
+    a1 = x1[i] * w;
+    b1 = x1[plane + i] * w;
+    a2 = x2[i] * w;
+    b2 = x2[plane + i] * w;
+    y1[i] = a1;
+    y1[plane + i] = b1;
+    y2[i] = a2;
+    y2[plane + i] = b2;
+    numerator += a1 * a2 + b1 * b2;
+    denomin_1 += a1 * a1 + b1 * b1;
+    denomin_2 += a2 * a2 + b2 * b2;
+  }
+  add_sum(&sums[0], numerator);
+  add_sum(&sums[1], denomin_1);
+  add_sum(&sums[2], denomin_2);
+  return;
+}
+
+static void corr_split_scalar(fftw_complex *in1, fftw_complex *in2, int64_t index, int64_t n, csum *sums){
+  real_t *x1 = (real_t *) in1, *x2 = (real_t *) in2;
+  double numerator = 0.0, denomin_1 = 0.0, denomin_2 = 0.0;
+  for (int64_t i = index; i < index + n; i++){
+    numerator += x1[i] * x2[i] + x1[plane + i] * x2[plane + i];
+    denomin_1 += x1[i] * x1[i] + x1[plane + i] * x1[plane + i];
+    denomin_2 += x2[i] * x2[i] + x2[plane + i] * x2[plane + i];
+  }
+  add_sum(&sums[0], numerator);
+  add_sum(&sums[1], denomin_1);
+  add_sum(&sums[2], denomin_2);
+  return;
+}
+
+static void add_split_scalar(fftw_complex *in, fftw_complex *out, int64_t index, int64_t n){
+  real_t *x = (real_t *) in, *y = (real_t *) out;
+  for (int64_t i = index; i < index + n; i++){
+    y[i] += x[i];
+    y[plane + i] += x[plane + i];
+  }
+  return;
+}
+
+static void spectra_split_scalar(fftw_complex *in1, fftw_complex *in2, uint16_t *shell, int64_t index, int64_t n, csum *out1, csum *out2, csum *nom, csum *dn1, csum *dn2, int32_t *count){
+  real_t *x1 = (real_t *) in1, *x2 = (real_t *) in2;
+  double q1, q2;
+  int32_t norms;
+  for (int64_t i = index; i < index + n; i++){
+    norms = shell[i];
+    q1 = x1[i] * x1[i] + x1[plane + i] * x1[plane + i];
+    q2 = x2[i] * x2[i] + x2[plane + i] * x2[plane + i];
+    add_sum(&out1[norms], sqrt(fabs(q1)));
+    add_sum(&out2[norms], sqrt(fabs(q2)));
+    if (nom){
+      add_sum(&nom[norms], x1[i] * x2[i] + x1[plane + i] * x2[plane + i]);
+      add_sum(&dn1[norms], q1);
+      add_sum(&dn2[norms], q2);
+    }
+    count[norms]++;
+  }
+  return;
+}
+
+static void shells_split_scalar(fftw_complex *in1, fftw_complex *in2, double *w1, double *w2, uint16_t *shell, int64_t index, int64_t n){
+  real_t *x1 = (real_t *) in1, *x2 = (real_t *) in2;
+  for (int64_t i = index; i < index + n; i++){
+    x1[i] *= w1[shell[i]];
+    x1[plane + i] *= w1[shell[i]];
+    x2[i] *= w2[shell[i]];
+    x2[plane + i] *= w2[shell[i]];
+  }
+  return;
+}
+
+#ifdef X86_KERNELS
+
+// Scatter per voxel magnitudes and products gathered by a vector kernel
+static void spectra_scatter(uint16_t *shell, int32_t n, double *m1, double *m2, double *p, double *s1, double *s2, csum *out1, csum *out2, csum *nom, csum *dn1, csum *dn2, int32_t *count){
+  int32_t norms;
+  for (int32_t j = 0; j < n; j++){
+    norms = shell[j];
+    add_sum(&out1[norms], m1[j]);
+    add_sum(&out2[norms], m2[j]);
+    if (nom){
+      add_sum(&nom[norms], p[j]);
+      add_sum(&dn1[norms], s1[j]);
+      add_sum(&dn2[norms], s2[j]);
+    }
+    count[norms]++;
+  }
+  return;
+}
+
+/* SSE2 kernels - one complex or two split parts per register */
+
+__attribute__((target("sse2")))
+static inline double hsum_sse2(__m128d v){
+  return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+__attribute__((target("sse2")))
+static void scale_sse2(fftw_complex *in, fftw_complex *out, double *table, uint32_t *r2, int64_t index, int64_t n){
+  double *x = (double *) in, *y = (double *) out;
+  for (int64_t i = index; i < index + n; i++){
+    _mm_storeu_pd(y + 2 * i, _mm_mul_pd(_mm_loadu_pd(x + 2 * i), _mm_set1_pd(table[r2[i]])));
+  }
+  return;
+}
+
+__attribute__((target("sse2")))
+static void pair_sse2(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, double *table, uint32_t *r2, int64_t index, int64_t n, csum *sums){
+  double *x1 = (double *) in1, *x2 = (double *) in2, *y1 = (double *) out1, *y2 = (double *) out2;
+  __m128d w, f1, f2, nom = _mm_setzero_pd(), dn1 = _mm_setzero_pd(), dn2 = _mm_setzero_pd();
+  for (int64_t i = index; i < index + n; i++){
+    w = _mm_set1_pd(table[r2[i]]);
+    f1 = _mm_mul_pd(_mm_loadu_pd(x1 + 2 * i), w);
+    f2 = _mm_mul_pd(_mm_loadu_pd(x2 + 2 * i), w);
+    _mm_storeu_pd(y1 + 2 * i, f1);
+    _mm_storeu_pd(y2 + 2 * i, f2);
+    if (sums){
+      nom = _mm_add_pd(nom, _mm_mul_pd(f1, f2));
+      dn1 = _mm_add_pd(dn1, _mm_mul_pd(f1, f1));
+      dn2 = _mm_add_pd(dn2, _mm_mul_pd(f2, f2));
+    }
+  }
+  if (sums){
+    add_sum(&sums[0], hsum_sse2(nom));
+    add_sum(&sums[1], hsum_sse2(dn1));
+    add_sum(&sums[2], hsum_sse2(dn2));
+  }
+  return;
+}
+
+__attribute__((target("sse2")))
+static void corr_sse2(fftw_complex *in1, fftw_complex *in2, int64_t index, int64_t n, csum *sums){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  __m128d f1, f2, nom = _mm_setzero_pd(), dn1 = _mm_setzero_pd(), dn2 = _mm_setzero_pd();
+  for (int64_t i = index; i < index + n; i++){
+    f1 = _mm_loadu_pd(x1 + 2 * i);
+    f2 = _mm_loadu_pd(x2 + 2 * i);
+    nom = _mm_add_pd(nom, _mm_mul_pd(f1, f2));
+    dn1 = _mm_add_pd(dn1, _mm_mul_pd(f1, f1));
+    dn2 = _mm_add_pd(dn2, _mm_mul_pd(f2, f2));
+  }
+  add_sum(&sums[0], hsum_sse2(nom));
+  add_sum(&sums[1], hsum_sse2(dn1));
+  add_sum(&sums[2], hsum_sse2(dn2));
+  return;
+}
+
+// Add n doubles of x to y
+__attribute__((target("sse2")))
+static void add_doubles_sse2(double *x, double *y, int64_t n){
+  int64_t i;
+  for (i = 0; i + 2 <= n; i += 2){
+    _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), _mm_loadu_pd(x + i)));
+  }
+  for (; i < n; i++){
+    y[i] += x[i];
+  }
+  return;
+}
+
+__attribute__((target("sse2")))
+static void add_sse2(fftw_complex *in, fftw_complex *out, int64_t index, int64_t n){
+  add_doubles_sse2((double *) (in + index), (double *) (out + index), 2 * n);
+  return;
+}
+
+__attribute__((target("sse2")))
+static void spectra_sse2(fftw_complex *in1, fftw_complex *in2, uint16_t *shell, int64_t index, int64_t n, csum *out1, csum *out2, csum *nom, csum *dn1, csum *dn2, int32_t *count){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  double m1[2], m2[2], p[2], s1[2], s2[2];
+  __m128d a1, b1, a2, b2, q1, q2;
+  int64_t i;
+  for (i = index; i + 2 <= index + n; i += 2){
+    a1 = _mm_loadu_pd(x1 + 2 * i);
+    b1 = _mm_loadu_pd(x1 + 2 * i + 2);
+    a2 = _mm_loadu_pd(x2 + 2 * i);
+    b2 = _mm_loadu_pd(x2 + 2 * i + 2);
+    // Pair real and imaginary parts of two voxels
+    q1 = _mm_mul_pd(a1, a1);
+    q1 = _mm_add_pd(_mm_unpacklo_pd(q1, _mm_mul_pd(b1, b1)), _mm_unpackhi_pd(q1, _mm_mul_pd(b1, b1)));
+    q2 = _mm_mul_pd(a2, a2);
+    q2 = _mm_add_pd(_mm_unpacklo_pd(q2, _mm_mul_pd(b2, b2)), _mm_unpackhi_pd(q2, _mm_mul_pd(b2, b2)));
+    _mm_storeu_pd(s1, q1);
+    _mm_storeu_pd(s2, q2);
+    _mm_storeu_pd(m1, _mm_sqrt_pd(q1));
+    _mm_storeu_pd(m2, _mm_sqrt_pd(q2));
+    if (nom){
+      q1 = _mm_mul_pd(a1, a2);
+      q2 = _mm_mul_pd(b1, b2);
+      _mm_storeu_pd(p, _mm_add_pd(_mm_unpacklo_pd(q1, q2), _mm_unpackhi_pd(q1, q2)));
+    }
+    spectra_scatter(shell + i, 2, m1, m2, p, s1, s2, out1, out2, nom, dn1, dn2, count);
+  }
+  spectra_scalar(in1, in2, shell, i, index + n - i, out1, out2, nom, dn1, dn2, count);
+  return;
+}
+
+__attribute__((target("sse2")))
+static void shells_sse2(fftw_complex *in1, fftw_complex *in2, double *w1, double *w2, uint16_t *shell, int64_t index, int64_t n){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  for (int64_t i = index; i < index + n; i++){
+    _mm_storeu_pd(x1 + 2 * i, _mm_mul_pd(_mm_loadu_pd(x1 + 2 * i), _mm_set1_pd(w1[shell[i]])));
+    _mm_storeu_pd(x2 + 2 * i, _mm_mul_pd(_mm_loadu_pd(x2 + 2 * i), _mm_set1_pd(w2[shell[i]])));
+  }
+  return;
+}
+
+__attribute__((target("sse2")))
+static void scale_split_sse2(fftw_complex *in, fftw_complex *out, double *table, uint32_t *r2, int64_t index, int64_t n){
+  double *x = (double *) in, *y = (double *) out;
+  __m128d w;
+  int64_t i;
+  for (i = index; i + 2 <= index + n; i += 2){
+    w = _mm_set_pd(table[r2[i + 1]], table[r2[i]]);
+    _mm_storeu_pd(y + i, _mm_mul_pd(_mm_loadu_pd(x + i), w));
+    _mm_storeu_pd(y + plane + i, _mm_mul_pd(_mm_loadu_pd(x + plane + i), w));
+  }
+  scale_split_scalar(in, out, table, r2, i, index + n - i);
+  return;
+}
+
+__attribute__((target("sse2")))
+static void pair_split_sse2(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, double *table, uint32_t *r2, int64_t index, int64_t n, csum *sums){
+  double *x1 = (double *) in1, *x2 = (double *) in2, *y1 = (double *) out1, *y2 = (double *) out2;
+  __m128d w, a1, b1, a2, b2, nom = _mm_setzero_pd(), dn1 = _mm_setzero_pd(), dn2 = _mm_setzero_pd();
+  int64_t i;
+  for (i = index; i + 2 <= index + n; i += 2){
+    w = _mm_set_pd(table[r2[i + 1]], table[r2[i]]);
+    a1 = _mm_mul_pd(_mm_loadu_pd(x1 + i), w);
+    b1 = _mm_mul_pd(_mm_loadu_pd(x1 + plane + i), w);
+    a2 = _mm_mul_pd(_mm_loadu_pd(x2 + i), w);
+    b2 = _mm_mul_pd(_mm_loadu_pd(x2 + plane + i), w);
+    _mm_storeu_pd(y1 + i, a1);
+    _mm_storeu_pd(y1 + plane + i, b1);
+    _mm_storeu_pd(y2 + i, a2);
+    _mm_storeu_pd(y2 + plane + i, b2);
+    if (sums){
+      nom = _mm_add_pd(nom, _mm_add_pd(_mm_mul_pd(a1, a2), _mm_mul_pd(b1, b2)));
+      dn1 = _mm_add_pd(dn1, _mm_add_pd(_mm_mul_pd(a1, a1), _mm_mul_pd(b1, b1)));
+      dn2 = _mm_add_pd(dn2, _mm_add_pd(_mm_mul_pd(a2, a2), _mm_mul_pd(b2, b2)));
+    }
+  }
+  if (sums){
+    add_sum(&sums[0], hsum_sse2(nom));
+    add_sum(&sums[1], hsum_sse2(dn1));
+    add_sum(&sums[2], hsum_sse2(dn2));
+  }
+  pair_split_scalar(in1, in2, out1, out2, table, r2, i, index + n - i, sums);
+  return;
+}
+
+__attribute__((target("sse2")))
+static void corr_split_sse2(fftw_complex *in1, fftw_complex *in2, int64_t index, int64_t n, csum *sums){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  __m128d a1, b1, a2, b2, nom = _mm_setzero_pd(), dn1 = _mm_setzero_pd(), dn2 = _mm_setzero_pd();
+  int64_t i;
+  for (i = index; i + 2 <= index + n; i += 2){
+    a1 = _mm_loadu_pd(x1 + i);
+    b1 = _mm_loadu_pd(x1 + plane + i);
+    a2 = _mm_loadu_pd(x2 + i);
+    b2 = _mm_loadu_pd(x2 + plane + i);
+    nom = _mm_add_pd(nom, _mm_add_pd(_mm_mul_pd(a1, a2), _mm_mul_pd(b1, b2)));
+    dn1 = _mm_add_pd(dn1, _mm_add_pd(_mm_mul_pd(a1, a1), _mm_mul_pd(b1, b1)));
+    dn2 = _mm_add_pd(dn2, _mm_add_pd(_mm_mul_pd(a2, a2), _mm_mul_pd(b2, b2)));
+  }
+  add_sum(&sums[0], hsum_sse2(nom));
+  add_sum(&sums[1], hsum_sse2(dn1));
+  add_sum(&sums[2], hsum_sse2(dn2));
+  corr_split_scalar(in1, in2, i, index + n - i, sums);
+  return;
+}
+
+__attribute__((target("sse2")))
+static void add_split_sse2(fftw_complex *in, fftw_complex *out, int64_t index, int64_t n){
+  add_doubles_sse2((double *) in + index, (double *) out + index, n);
+  add_doubles_sse2((double *) in + plane + index, (double *) out + plane + index, n);
+  return;
+}
+
+__attribute__((target("sse2")))
+static void shells_split_sse2(fftw_complex *in1, fftw_complex *in2, double *w1, double *w2, uint16_t *shell, int64_t index, int64_t n){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  __m128d w;
+  int64_t i;
+  for (i = index; i + 2 <= index + n; i += 2){
+    w = _mm_set_pd(w1[shell[i + 1]], w1[shell[i]]);
+    _mm_storeu_pd(x1 + i, _mm_mul_pd(_mm_loadu_pd(x1 + i), w));
+    _mm_storeu_pd(x1 + plane + i, _mm_mul_pd(_mm_loadu_pd(x1 + plane + i), w));
+    w = _mm_set_pd(w2[shell[i + 1]], w2[shell[i]]);
+    _mm_storeu_pd(x2 + i, _mm_mul_pd(_mm_loadu_pd(x2 + i), w));
+    _mm_storeu_pd(x2 + plane + i, _mm_mul_pd(_mm_loadu_pd(x2 + plane + i), w));
+  }
+  shells_split_scalar(in1, in2, w1, w2, shell, i, index + n - i);
+  return;
+}
+
+/* AVX2 kernels - two complexes or four split parts per register */
+
+__attribute__((target("avx2")))
+static inline double hsum_avx2(__m256d v){
+  __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+// Per voxel sums of lane pairs of a and b in voxel order
+__attribute__((target("avx2")))
+static inline __m256d pairs_avx2(__m256d a, __m256d b){
+  return _mm256_permute4x64_pd(_mm256_hadd_pd(a, b), 0xD8);
+}
+
+__attribute__((target("avx2")))
+static void scale_avx2(fftw_complex *in, fftw_complex *out, double *table, uint32_t *r2, int64_t index, int64_t n){
+  double *x = (double *) in, *y = (double *) out;
+  __m256d w;
+  int64_t i;
+  for (i = index; i + 4 <= index + n; i += 4){
+    w = _mm256_i32gather_pd(table, _mm_loadu_si128((__m128i *) (r2 + i)), 8);
+    _mm256_storeu_pd(y + 2 * i, _mm256_mul_pd(_mm256_loadu_pd(x + 2 * i), _mm256_permute4x64_pd(w, 0x50)));
+    _mm256_storeu_pd(y + 2 * i + 4, _mm256_mul_pd(_mm256_loadu_pd(x + 2 * i + 4), _mm256_permute4x64_pd(w, 0xFA)));
+  }
+  scale_scalar(in, out, table, r2, i, index + n - i);
+  return;
+}
+
+__attribute__((target("avx2")))
+static void pair_avx2(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, double *table, uint32_t *r2, int64_t index, int64_t n, csum *sums){
+  double *x1 = (double *) in1, *x2 = (double *) in2, *y1 = (double *) out1, *y2 = (double *) out2;
+  __m256d w, wl, wh, a1, b1, a2, b2;
+  __m256d nom = _mm256_setzero_pd(), dn1 = _mm256_setzero_pd(), dn2 = _mm256_setzero_pd();
+  int64_t i;
+  for (i = index; i + 4 <= index + n; i += 4){
+    w = _mm256_i32gather_pd(table, _mm_loadu_si128((__m128i *) (r2 + i)), 8);
+    wl = _mm256_permute4x64_pd(w, 0x50);
+    wh = _mm256_permute4x64_pd(w, 0xFA);
+    a1 = _mm256_mul_pd(_mm256_loadu_pd(x1 + 2 * i), wl);
+    b1 = _mm256_mul_pd(_mm256_loadu_pd(x1 + 2 * i + 4), wh);
+    a2 = _mm256_mul_pd(_mm256_loadu_pd(x2 + 2 * i), wl);
+    b2 = _mm256_mul_pd(_mm256_loadu_pd(x2 + 2 * i + 4), wh);
+    _mm256_storeu_pd(y1 + 2 * i, a1);
+    _mm256_storeu_pd(y1 + 2 * i + 4, b1);
+    _mm256_storeu_pd(y2 + 2 * i, a2);
+    _mm256_storeu_pd(y2 + 2 * i + 4, b2);
+    if (sums){
+      nom = _mm256_add_pd(nom, _mm256_add_pd(_mm256_mul_pd(a1, a2), _mm256_mul_pd(b1, b2)));
+      dn1 = _mm256_add_pd(dn1, _mm256_add_pd(_mm256_mul_pd(a1, a1), _mm256_mul_pd(b1, b1)));
+      dn2 = _mm256_add_pd(dn2, _mm256_add_pd(_mm256_mul_pd(a2, a2), _mm256_mul_pd(b2, b2)));
+    }
+  }
+  if (sums){
+    add_sum(&sums[0], hsum_avx2(nom));
+    add_sum(&sums[1], hsum_avx2(dn1));
+    add_sum(&sums[2], hsum_avx2(dn2));
+  }
+  pair_scalar(in1, in2, out1, out2, table, r2, i, index + n - i, sums);
+  return;
+}
+
+__attribute__((target("avx2")))
+static void corr_avx2(fftw_complex *in1, fftw_complex *in2, int64_t index, int64_t n, csum *sums){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  __m256d f1, f2, nom = _mm256_setzero_pd(), dn1 = _mm256_setzero_pd(), dn2 = _mm256_setzero_pd();
+  int64_t i;
+  for (i = index; i + 2 <= index + n; i += 2){
+    f1 = _mm256_loadu_pd(x1 + 2 * i);
+    f2 = _mm256_loadu_pd(x2 + 2 * i);
+    nom = _mm256_add_pd(nom, _mm256_mul_pd(f1, f2));
+    dn1 = _mm256_add_pd(dn1, _mm256_mul_pd(f1, f1));
+    dn2 = _mm256_add_pd(dn2, _mm256_mul_pd(f2, f2));
+  }
+  add_sum(&sums[0], hsum_avx2(nom));
+  add_sum(&sums[1], hsum_avx2(dn1));
+  add_sum(&sums[2], hsum_avx2(dn2));
+  corr_scalar(in1, in2, i, index + n - i, sums);
+  return;
+}
+
+// Add n doubles of x to y
+__attribute__((target("avx2")))
+static void add_doubles_avx2(double *x, double *y, int64_t n){
+  int64_t i;
+  for (i = 0; i + 4 <= n; i += 4){
+    _mm256_storeu_pd(y + i, _mm256_add_pd(_mm256_loadu_pd(y + i), _mm256_loadu_pd(x + i)));
+  }
+  for (; i < n; i++){
+    y[i] += x[i];
+  }
+  return;
+}
+
+__attribute__((target("avx2")))
+static void add_avx2(fftw_complex *in, fftw_complex *out, int64_t index, int64_t n){
+  add_doubles_avx2((double *) (in + index), (double *) (out + index), 2 * n);
+  return;
+}
+
+__attribute__((target("avx2")))
+static void spectra_avx2(fftw_complex *in1, fftw_complex *in2, uint16_t *shell, int64_t index, int64_t n, csum *out1, csum *out2, csum *nom, csum *dn1, csum *dn2, int32_t *count){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  double m1[4], m2[4], p[4], s1[4], s2[4];
+  __m256d a1, b1, a2, b2, q1, q2;
+  int64_t i;
+  for (i = index; i + 4 <= index + n; i += 4){
+    a1 = _mm256_loadu_pd(x1 + 2 * i);
+    b1 = _mm256_loadu_pd(x1 + 2 * i + 4);
+    a2 = _mm256_loadu_pd(x2 + 2 * i);
+    b2 = _mm256_loadu_pd(x2 + 2 * i + 4);
+    q1 = pairs_avx2(_mm256_mul_pd(a1, a1), _mm256_mul_pd(b1, b1));
+    q2 = pairs_avx2(_mm256_mul_pd(a2, a2), _mm256_mul_pd(b2, b2));
+    _mm256_storeu_pd(s1, q1);
+    _mm256_storeu_pd(s2, q2);
+    _mm256_storeu_pd(m1, _mm256_sqrt_pd(q1));
+    _mm256_storeu_pd(m2, _mm256_sqrt_pd(q2));
+    if (nom){
+      _mm256_storeu_pd(p, pairs_avx2(_mm256_mul_pd(a1, a2), _mm256_mul_pd(b1, b2)));
+    }
+    spectra_scatter(shell + i, 4, m1, m2, p, s1, s2, out1, out2, nom, dn1, dn2, count);
+  }
+  spectra_scalar(in1, in2, shell, i, index + n - i, out1, out2, nom, dn1, dn2, count);
+  return;
+}
+
+__attribute__((target("avx2")))
+static void shells_avx2(fftw_complex *in1, fftw_complex *in2, double *w1, double *w2, uint16_t *shell, int64_t index, int64_t n){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  __m128i idx;
+  __m256d w;
+  int64_t i;
+  for (i = index; i + 4 <= index + n; i += 4){
+    idx = _mm_cvtepu16_epi32(_mm_loadl_epi64((__m128i *) (shell + i)));
+    w = _mm256_i32gather_pd(w1, idx, 8);
+    _mm256_storeu_pd(x1 + 2 * i, _mm256_mul_pd(_mm256_loadu_pd(x1 + 2 * i), _mm256_permute4x64_pd(w, 0x50)));
+    _mm256_storeu_pd(x1 + 2 * i + 4, _mm256_mul_pd(_mm256_loadu_pd(x1 + 2 * i + 4), _mm256_permute4x64_pd(w, 0xFA)));
+    w = _mm256_i32gather_pd(w2, idx, 8);
+    _mm256_storeu_pd(x2 + 2 * i, _mm256_mul_pd(_mm256_loadu_pd(x2 + 2 * i), _mm256_permute4x64_pd(w, 0x50)));
+    _mm256_storeu_pd(x2 + 2 * i + 4, _mm256_mul_pd(_mm256_loadu_pd(x2 + 2 * i + 4), _mm256_permute4x64_pd(w, 0xFA)));
+  }
+  shells_scalar(in1, in2, w1, w2, shell, i, index + n - i);
+  return;
+}
+
+__attribute__((target("avx2")))
+static void scale_split_avx2(fftw_complex *in, fftw_complex *out, double *table, uint32_t *r2, int64_t index, int64_t n){
+  double *x = (double *) in, *y = (double *) out;
+  __m256d w;
+  int64_t i;
+  for (i = index; i + 4 <= index + n; i += 4){
+    w = _mm256_i32gather_pd(table, _mm_loadu_si128((__m128i *) (r2 + i)), 8);
+    _mm256_storeu_pd(y + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), w));
+    _mm256_storeu_pd(y + plane + i, _mm256_mul_pd(_mm256_loadu_pd(x + plane + i), w));
+  }
+  scale_split_scalar(in, out, table, r2, i, index + n - i);
+  return;
+}
+
+__attribute__((target("avx2")))
+static void pair_split_avx2(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, double *table, uint32_t *r2, int64_t index, int64_t n, csum *sums){
+  double *x1 = (double *) in1, *x2 = (double *) in2, *y1 = (double *) out1, *y2 = (double *) out2;
+  __m256d w, a1, b1, a2, b2;
+  __m256d nom = _mm256_setzero_pd(), dn1 = _mm256_setzero_pd(), dn2 = _mm256_setzero_pd();
+  int64_t i;
+  for (i = index; i + 4 <= index + n; i += 4){
+    w = _mm256_i32gather_pd(table, _mm_loadu_si128((__m128i *) (r2 + i)), 8);
+    a1 = _mm256_mul_pd(_mm256_loadu_pd(x1 + i), w);
+    b1 = _mm256_mul_pd(_mm256_loadu_pd(x1 + plane + i), w);
+    a2 = _mm256_mul_pd(_mm256_loadu_pd(x2 + i), w);
+    b2 = _mm256_mul_pd(_mm256_loadu_pd(x2 + plane + i), w);
+    _mm256_storeu_pd(y1 + i, a1);
+    _mm256_storeu_pd(y1 + plane + i, b1);
+    _mm256_storeu_pd(y2 + i, a2);
+    _mm256_storeu_pd(y2 + plane + i, b2);
+    if (sums){
+      nom = _mm256_add_pd(nom, _mm256_add_pd(_mm256_mul_pd(a1, a2), _mm256_mul_pd(b1, b2)));
+      dn1 = _mm256_add_pd(dn1, _mm256_add_pd(_mm256_mul_pd(a1, a1), _mm256_mul_pd(b1, b1)));
+      dn2 = _mm256_add_pd(dn2, _mm256_add_pd(_mm256_mul_pd(a2, a2), _mm256_mul_pd(b2, b2)));
+    }
+  }
+  if (sums){
+    add_sum(&sums[0], hsum_avx2(nom));
+    add_sum(&sums[1], hsum_avx2(dn1));
+    add_sum(&sums[2], hsum_avx2(dn2));
+  }
+  pair_split_scalar(in1, in2, out1, out2, table, r2, i, index + n - i, sums);
+  return;
+}
+
+__attribute__((target("avx2")))
+static void corr_split_avx2(fftw_complex *in1, fftw_complex *in2, int64_t index, int64_t n, csum *sums){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  __m256d a1, b1, a2, b2;
+  __m256d nom = _mm256_setzero_pd(), dn1 = _mm256_setzero_pd(), dn2 = _mm256_setzero_pd();
+  int64_t i;
+  for (i = index; i + 4 <= index + n; i += 4){
+    a1 = _mm256_loadu_pd(x1 + i);
+    b1 = _mm256_loadu_pd(x1 + plane + i);
+    a2 = _mm256_loadu_pd(x2 + i);
+    b2 = _mm256_loadu_pd(x2 + plane + i);
+    nom = _mm256_add_pd(nom, _mm256_add_pd(_mm256_mul_pd(a1, a2), _mm256_mul_pd(b1, b2)));
+    dn1 = _mm256_add_pd(dn1, _mm256_add_pd(_mm256_mul_pd(a1, a1), _mm256_mul_pd(b1, b1)));
+    dn2 = _mm256_add_pd(dn2, _mm256_add_pd(_mm256_mul_pd(a2, a2), _mm256_mul_pd(b2, b2)));
+  }
+  add_sum(&sums[0], hsum_avx2(nom));
+  add_sum(&sums[1], hsum_avx2(dn1));
+  add_sum(&sums[2], hsum_avx2(dn2));
+  corr_split_scalar(in1, in2, i, index + n - i, sums);
+  return;
+}
+
+__attribute__((target("avx2")))
+static void add_split_avx2(fftw_complex *in, fftw_complex *out, int64_t index, int64_t n){
+  add_doubles_avx2((double *) in + index, (double *) out + index, n);
+  add_doubles_avx2((double *) in + plane + index, (double *) out + plane + index, n);
+  return;
+}
+
+__attribute__((target("avx2")))
+static void spectra_split_avx2(fftw_complex *in1, fftw_complex *in2, uint16_t *shell, int64_t index, int64_t n, csum *out1, csum *out2, csum *nom, csum *dn1, csum *dn2, int32_t *count){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  double m1[4], m2[4], p[4], s1[4], s2[4];
+  __m256d a1, b1, a2, b2, q1, q2;
+  int64_t i;
+  for (i = index; i + 4 <= index + n; i += 4){
+    a1 = _mm256_loadu_pd(x1 + i);
+    b1 = _mm256_loadu_pd(x1 + plane + i);
+    a2 = _mm256_loadu_pd(x2 + i);
+    b2 = _mm256_loadu_pd(x2 + plane + i);
+    q1 = _mm256_add_pd(_mm256_mul_pd(a1, a1), _mm256_mul_pd(b1, b1));
+    q2 = _mm256_add_pd(_mm256_mul_pd(a2, a2), _mm256_mul_pd(b2, b2));
+    _mm256_storeu_pd(s1, q1);
+    _mm256_storeu_pd(s2, q2);
+    _mm256_storeu_pd(m1, _mm256_sqrt_pd(q1));
+    _mm256_storeu_pd(m2, _mm256_sqrt_pd(q2));
+    if (nom){
+      _mm256_storeu_pd(p, _mm256_add_pd(_mm256_mul_pd(a1, a2), _mm256_mul_pd(b1, b2)));
+    }
+    spectra_scatter(shell + i, 4, m1, m2, p, s1, s2, out1, out2, nom, dn1, dn2, count);
+  }
+  spectra_split_scalar(in1, in2, shell, i, index + n - i, out1, out2, nom, dn1, dn2, count);
+  return;
+}
+
+__attribute__((target("avx2")))
+static void shells_split_avx2(fftw_complex *in1, fftw_complex *in2, double *w1, double *w2, uint16_t *shell, int64_t index, int64_t n){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  __m128i idx;
+  __m256d w;
+  int64_t i;
+  for (i = index; i + 4 <= index + n; i += 4){
+    idx = _mm_cvtepu16_epi32(_mm_loadl_epi64((__m128i *) (shell + i)));
+    w = _mm256_i32gather_pd(w1, idx, 8);
+    _mm256_storeu_pd(x1 + i, _mm256_mul_pd(_mm256_loadu_pd(x1 + i), w));
+    _mm256_storeu_pd(x1 + plane + i, _mm256_mul_pd(_mm256_loadu_pd(x1 + plane + i), w));
+    w = _mm256_i32gather_pd(w2, idx, 8);
+    _mm256_storeu_pd(x2 + i, _mm256_mul_pd(_mm256_loadu_pd(x2 + i), w));
+    _mm256_storeu_pd(x2 + plane + i, _mm256_mul_pd(_mm256_loadu_pd(x2 + plane + i), w));
+  }
+  shells_split_scalar(in1, in2, w1, w2, shell, i, index + n - i);
+  return;
+}
+
+/* AVX-512 kernels - four complexes or eight split parts per register */
+
+// Spread eight weights over the real and imaginary lanes of eight voxels
+__attribute__((target("avx512f")))
+static inline void spread_avx512(__m512d w, __m512d *lo, __m512d *hi){
+  *lo = _mm512_permutexvar_pd(_mm512_set_epi64(3, 3, 2, 2, 1, 1, 0, 0), w);
+  *hi = _mm512_permutexvar_pd(_mm512_set_epi64(7, 7, 6, 6, 5, 5, 4, 4), w);
+  return;
+}
+
+__attribute__((target("avx512f")))
+static void scale_avx512(fftw_complex *in, fftw_complex *out, double *table, uint32_t *r2, int64_t index, int64_t n){
+  double *x = (double *) in, *y = (double *) out;
+  __m512d wl, wh;
+  int64_t i;
+  for (i = index; i + 8 <= index + n; i += 8){
+    spread_avx512(_mm512_i32gather_pd(_mm256_loadu_si256((__m256i *) (r2 + i)), table, 8), &wl, &wh);
+    _mm512_storeu_pd(y + 2 * i, _mm512_mul_pd(_mm512_loadu_pd(x + 2 * i), wl));
+    _mm512_storeu_pd(y + 2 * i + 8, _mm512_mul_pd(_mm512_loadu_pd(x + 2 * i + 8), wh));
+  }
+  scale_scalar(in, out, table, r2, i, index + n - i);
+  return;
+}
+
+__attribute__((target("avx512f")))
+static void pair_avx512(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, double *table, uint32_t *r2, int64_t index, int64_t n, csum *sums){
+  double *x1 = (double *) in1, *x2 = (double *) in2, *y1 = (double *) out1, *y2 = (double *) out2;
+  __m512d wl, wh, a1, b1, a2, b2;
+  __m512d nom = _mm512_setzero_pd(), dn1 = _mm512_setzero_pd(), dn2 = _mm512_setzero_pd();
+  int64_t i;
+  for (i = index; i + 8 <= index + n; i += 8){
+    spread_avx512(_mm512_i32gather_pd(_mm256_loadu_si256((__m256i *) (r2 + i)), table, 8), &wl, &wh);
+    a1 = _mm512_mul_pd(_mm512_loadu_pd(x1 + 2 * i), wl);
+    b1 = _mm512_mul_pd(_mm512_loadu_pd(x1 + 2 * i + 8), wh);
+    a2 = _mm512_mul_pd(_mm512_loadu_pd(x2 + 2 * i), wl);
+    b2 = _mm512_mul_pd(_mm512_loadu_pd(x2 + 2 * i + 8), wh);
+    _mm512_storeu_pd(y1 + 2 * i, a1);
+    _mm512_storeu_pd(y1 + 2 * i + 8, b1);
+    _mm512_storeu_pd(y2 + 2 * i, a2);
+    _mm512_storeu_pd(y2 + 2 * i + 8, b2);
+    if (sums){
+      nom = _mm512_add_pd(nom, _mm512_add_pd(_mm512_mul_pd(a1, a2), _mm512_mul_pd(b1, b2)));
+      dn1 = _mm512_add_pd(dn1, _mm512_add_pd(_mm512_mul_pd(a1, a1), _mm512_mul_pd(b1, b1)));
+      dn2 = _mm512_add_pd(dn2, _mm512_add_pd(_mm512_mul_pd(a2, a2), _mm512_mul_pd(b2, b2)));
+    }
+  }
+  if (sums){
+    add_sum(&sums[0], _mm512_reduce_add_pd(nom));
+    add_sum(&sums[1], _mm512_reduce_add_pd(dn1));
+    add_sum(&sums[2], _mm512_reduce_add_pd(dn2));
+  }
+  pair_scalar(in1, in2, out1, out2, table, r2, i, index + n - i, sums);
+  return;
+}
+
+__attribute__((target("avx512f")))
+static void corr_avx512(fftw_complex *in1, fftw_complex *in2, int64_t index, int64_t n, csum *sums){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  __m512d f1, f2, nom = _mm512_setzero_pd(), dn1 = _mm512_setzero_pd(), dn2 = _mm512_setzero_pd();
+  int64_t i;
+  for (i = index; i + 4 <= index + n; i += 4){
+    f1 = _mm512_loadu_pd(x1 + 2 * i);
+    f2 = _mm512_loadu_pd(x2 + 2 * i);
+    nom = _mm512_add_pd(nom, _mm512_mul_pd(f1, f2));
+    dn1 = _mm512_add_pd(dn1, _mm512_mul_pd(f1, f1));
+    dn2 = _mm512_add_pd(dn2, _mm512_mul_pd(f2, f2));
+  }
+  add_sum(&sums[0], _mm512_reduce_add_pd(nom));
+  add_sum(&sums[1], _mm512_reduce_add_pd(dn1));
+  add_sum(&sums[2], _mm512_reduce_add_pd(dn2));
+  corr_scalar(in1, in2, i, index + n - i, sums);
+  return;
+}
+
+// Add n doubles of x to y
+__attribute__((target("avx512f")))
+static void add_doubles_avx512(double *x, double *y, int64_t n){
+  int64_t i;
+  for (i = 0; i + 8 <= n; i += 8){
+    _mm512_storeu_pd(y + i, _mm512_add_pd(_mm512_loadu_pd(y + i), _mm512_loadu_pd(x + i)));
+  }
+  for (; i < n; i++){
+    y[i] += x[i];
+  }
+  return;
+}
+
+__attribute__((target("avx512f")))
+static void add_avx512(fftw_complex *in, fftw_complex *out, int64_t index, int64_t n){
+  add_doubles_avx512((double *) (in + index), (double *) (out + index), 2 * n);
+  return;
+}
+
+__attribute__((target("avx512f")))
+static void shells_avx512(fftw_complex *in1, fftw_complex *in2, double *w1, double *w2, uint16_t *shell, int64_t index, int64_t n){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  __m256i idx;
+  __m512d wl, wh;
+  int64_t i;
+  for (i = index; i + 8 <= index + n; i += 8){
+    idx = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *) (shell + i)));
+    spread_avx512(_mm512_i32gather_pd(idx, w1, 8), &wl, &wh);
+    _mm512_storeu_pd(x1 + 2 * i, _mm512_mul_pd(_mm512_loadu_pd(x1 + 2 * i), wl));
+    _mm512_storeu_pd(x1 + 2 * i + 8, _mm512_mul_pd(_mm512_loadu_pd(x1 + 2 * i + 8), wh));
+    spread_avx512(_mm512_i32gather_pd(idx, w2, 8), &wl, &wh);
+    _mm512_storeu_pd(x2 + 2 * i, _mm512_mul_pd(_mm512_loadu_pd(x2 + 2 * i), wl));
+    _mm512_storeu_pd(x2 + 2 * i + 8, _mm512_mul_pd(_mm512_loadu_pd(x2 + 2 * i + 8), wh));
+  }
+  shells_scalar(in1, in2, w1, w2, shell, i, index + n - i);
+  return;
+}
+
+__attribute__((target("avx512f")))
+static void scale_split_avx512(fftw_complex *in, fftw_complex *out, double *table, uint32_t *r2, int64_t index, int64_t n){
+  double *x = (double *) in, *y = (double *) out;
+  __m512d w;
+  int64_t i;
+  for (i = index; i + 8 <= index + n; i += 8){
+    w = _mm512_i32gather_pd(_mm256_loadu_si256((__m256i *) (r2 + i)), table, 8);
+    _mm512_storeu_pd(y + i, _mm512_mul_pd(_mm512_loadu_pd(x + i), w));
+    _mm512_storeu_pd(y + plane + i, _mm512_mul_pd(_mm512_loadu_pd(x + plane + i), w));
+  }
+  scale_split_scalar(in, out, table, r2, i, index + n - i);
+  return;
+}
+
+__attribute__((target("avx512f")))
+static void pair_split_avx512(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, double *table, uint32_t *r2, int64_t index, int64_t n, csum *sums){
+  double *x1 = (double *) in1, *x2 = (double *) in2, *y1 = (double *) out1, *y2 = (double *) out2;
+  __m512d w, a1, b1, a2, b2;
+  __m512d nom = _mm512_setzero_pd(), dn1 = _mm512_setzero_pd(), dn2 = _mm512_setzero_pd();
+  int64_t i;
+  for (i = index; i + 8 <= index + n; i += 8){
+    w = _mm512_i32gather_pd(_mm256_loadu_si256((__m256i *) (r2 + i)), table, 8);
+    a1 = _mm512_mul_pd(_mm512_loadu_pd(x1 + i), w);
+    b1 = _mm512_mul_pd(_mm512_loadu_pd(x1 + plane + i), w);
+    a2 = _mm512_mul_pd(_mm512_loadu_pd(x2 + i), w);
+    b2 = _mm512_mul_pd(_mm512_loadu_pd(x2 + plane + i), w);
+    _mm512_storeu_pd(y1 + i, a1);
+    _mm512_storeu_pd(y1 + plane + i, b1);
+    _mm512_storeu_pd(y2 + i, a2);
+    _mm512_storeu_pd(y2 + plane + i, b2);
+    if (sums){
+      nom = _mm512_add_pd(nom, _mm512_add_pd(_mm512_mul_pd(a1, a2), _mm512_mul_pd(b1, b2)));
+      dn1 = _mm512_add_pd(dn1, _mm512_add_pd(_mm512_mul_pd(a1, a1), _mm512_mul_pd(b1, b1)));
+      dn2 = _mm512_add_pd(dn2, _mm512_add_pd(_mm512_mul_pd(a2, a2), _mm512_mul_pd(b2, b2)));
+    }
+  }
+  if (sums){
+    add_sum(&sums[0], _mm512_reduce_add_pd(nom));
+    add_sum(&sums[1], _mm512_reduce_add_pd(dn1));
+    add_sum(&sums[2], _mm512_reduce_add_pd(dn2));
+  }
+  pair_split_scalar(in1, in2, out1, out2, table, r2, i, index + n - i, sums);
+  return;
+}
+
+__attribute__((target("avx512f")))
+static void corr_split_avx512(fftw_complex *in1, fftw_complex *in2, int64_t index, int64_t n, csum *sums){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  __m512d a1, b1, a2, b2;
+  __m512d nom = _mm512_setzero_pd(), dn1 = _mm512_setzero_pd(), dn2 = _mm512_setzero_pd();
+  int64_t i;
+  for (i = index; i + 8 <= index + n; i += 8){
+    a1 = _mm512_loadu_pd(x1 + i);
+    b1 = _mm512_loadu_pd(x1 + plane + i);
+    a2 = _mm512_loadu_pd(x2 + i);
+    b2 = _mm512_loadu_pd(x2 + plane + i);
+    nom = _mm512_add_pd(nom, _mm512_add_pd(_mm512_mul_pd(a1, a2), _mm512_mul_pd(b1, b2)));
+    dn1 = _mm512_add_pd(dn1, _mm512_add_pd(_mm512_mul_pd(a1, a1), _mm512_mul_pd(b1, b1)));
+    dn2 = _mm512_add_pd(dn2, _mm512_add_pd(_mm512_mul_pd(a2, a2), _mm512_mul_pd(b2, b2)));
+  }
+  add_sum(&sums[0], _mm512_reduce_add_pd(nom));
+  add_sum(&sums[1], _mm512_reduce_add_pd(dn1));
+  add_sum(&sums[2], _mm512_reduce_add_pd(dn2));
+  corr_split_scalar(in1, in2, i, index + n - i, sums);
+  return;
+}
+
+__attribute__((target("avx512f")))
+static void add_split_avx512(fftw_complex *in, fftw_complex *out, int64_t index, int64_t n){
+  add_doubles_avx512((double *) in + index, (double *) out + index, n);
+  add_doubles_avx512((double *) in + plane + index, (double *) out + plane + index, n);
+  return;
+}
+
+__attribute__((target("avx512f")))
+static void shells_split_avx512(fftw_complex *in1, fftw_complex *in2, double *w1, double *w2, uint16_t *shell, int64_t index, int64_t n){
+  double *x1 = (double *) in1, *x2 = (double *) in2;
+  __m256i idx;
+  __m512d w;
+  int64_t i;
+  for (i = index; i + 8 <= index + n; i += 8){
+    idx = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *) (shell + i)));
+    w = _mm512_i32gather_pd(idx, w1, 8);
+    _mm512_storeu_pd(x1 + i, _mm512_mul_pd(_mm512_loadu_pd(x1 + i), w));
+    _mm512_storeu_pd(x1 + plane + i, _mm512_mul_pd(_mm512_loadu_pd(x1 + plane + i), w));
+    w = _mm512_i32gather_pd(idx, w2, 8);
+    _mm512_storeu_pd(x2 + i, _mm512_mul_pd(_mm512_loadu_pd(x2 + i), w));
+    _mm512_storeu_pd(x2 + plane + i, _mm512_mul_pd(_mm512_loadu_pd(x2 + plane + i), w));
+  }
+  shells_split_scalar(in1, in2, w1, w2, shell, i, index + n - i);
+  return;
+}
+
+#endif
+
+// Kernel tables by instruction set - spectra is scatter bound so AVX-512 shares the AVX2 kernel
+static kernels variants[4] = {
+  {scale_scalar, pair_scalar, corr_scalar, add_scalar, spectra_scalar, shells_scalar, "scalar"},
+#ifdef X86_KERNELS
+  {scale_sse2, pair_sse2, corr_sse2, add_sse2, spectra_sse2, shells_sse2, "SSE2"},
+  {scale_avx2, pair_avx2, corr_avx2, add_avx2, spectra_avx2, shells_avx2, "AVX2"},
+  {scale_avx512, pair_avx512, corr_avx512, add_avx512, spectra_avx2, shells_avx512, "AVX-512"}
+#endif
+};
+
+// Kernel tables for split storage - SSE2 spectra gains nothing over scalar
+static kernels splits[4] = {
+  {scale_split_scalar, pair_split_scalar, corr_split_scalar, add_split_scalar, spectra_split_scalar, shells_split_scalar, "scalar"},
+#ifdef X86_KERNELS
+  {scale_split_sse2, pair_split_sse2, corr_split_sse2, add_split_sse2, spectra_split_scalar, shells_split_sse2, "SSE2"},
+  {scale_split_avx2, pair_split_avx2, corr_split_avx2, add_split_avx2, spectra_split_avx2, shells_split_avx2, "AVX2"},
+  {scale_split_avx512, pair_split_avx512, corr_split_avx512, add_split_avx512, spectra_split_avx2, shells_split_avx512, "AVX-512"}
+#endif
+};
+
+// Scalar interleaved until kernels are selected
+static kernels *active = &variants[SIMD_SCALAR];
+
+// Widest instruction set this CPU supports
+int8_t best_kernels(void){
+#ifdef X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")){
+    return SIMD_AVX512;
+  }
+  if (__builtin_cpu_supports("avx2")){
+    return SIMD_AVX2;
+  }
+  if (__builtin_cpu_supports("sse2")){
+    return SIMD_SSE2;
+  }
+#endif
+  return SIMD_SCALAR;
+}
+
+void set_kernels(int8_t mode){
+  int8_t best = best_kernels();
+  if (mode == SIMD_AUTO){
+    mode = best;
+#ifdef SINGLE_PRECISION
+  } else if (mode > SIMD_SCALAR){
+    printf("\n\t Vector Fourier kernels exist only in the double precision build - this single precision build uses scalar kernels\n\n");
+    exit(1);
+#endif
+  } else if (mode > best){
+    printf("\n\t Fourier kernels %s are not supported by this CPU\n\n", variants[mode].name ? variants[mode].name : "requested");
+    exit(1);
+  }
+  kernel_set = mode;
+  active = split ? &splits[kernel_set] : &variants[kernel_set];
+  printf("\n\t Fourier kernels | %s\n", active->name);
+  fflush(stdout);
+  return;
+}
+
+// Half transforms of box full are stored interleaved or as split planes
+void set_layout(int8_t mode, int32_t full){
+  split = mode;
+  plane = split_offset(full);
+  active = split ? &splits[kernel_set] : &variants[kernel_set];
+  return;
+}
+
+int8_t split_layout(void){
+  return split;
+}
+
+int64_t split_offset(int32_t full){
+  return (int64_t) full * full * (full / 2 + 1) + SPLIT_PAD;
+}
+
+size_t fourier_bytes(int32_t full){
+  if (split){
+    return 2 * split_offset(full) * sizeof(real_t);
+  }
+  return (size_t) full * full * (full / 2 + 1) * sizeof(fftw_complex);
+}
+
+int64_t fourier_stride(int32_t full){
+  return (int64_t) (fourier_bytes(full) / sizeof(fftw_complex));
+}
+
+fftw_complex get_coef(fftw_complex *map, int64_t index){
+  if (split){
+    return ((real_t *) map)[index] + ((real_t *) map)[plane + index] * I;
+  }
+  return map[index];
+}
+
+void set_coef(fftw_complex *map, int64_t index, fftw_complex value){
+  if (split){
+    ((real_t *) map)[index] = creal(value);
+    ((real_t *) map)[plane + index] = cimag(value);
+    return;
+  }
+  map[index] = value;
+  return;
+}
+
+void zero_row(fftw_complex *map, int64_t index, int64_t n){
+  if (split){
+    memset((real_t *) map + index, 0, n * sizeof(real_t));
+    memset((real_t *) map + plane + index, 0, n * sizeof(real_t));
+    return;
+  }
+  memset(map + index, 0, n * sizeof(fftw_complex));
+  return;
+}
+
+void scale_row(fftw_complex *in, fftw_complex *out, double *table, uint32_t *r2, int64_t index, int64_t n){
+  active->scale(in, out, table, r2, index, n);
+  return;
+}
+
+void pair_row(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, double *table, uint32_t *r2, int64_t index, int64_t n, csum *sums){
+  active->pair(in1, in2, out1, out2, table, r2, index, n, sums);
+  return;
+}
+
+void corr_row(fftw_complex *in1, fftw_complex *in2, int64_t index, int64_t n, csum *sums){
+  active->corr(in1, in2, index, n, sums);
+  return;
+}
+
+void add_row(fftw_complex *in, fftw_complex *out, int64_t index, int64_t n){
+  active->add(in, out, index, n);
+  return;
+}
+
+void spectra_row(fftw_complex *in1, fftw_complex *in2, uint16_t *shell, int64_t index, int64_t n, csum *out1, csum *out2, csum *nom, csum *dn1, csum *dn2, int32_t *count){
+  active->spectra(in1, in2, shell, index, n, out1, out2, nom, dn1, dn2, count);
+  return;
+}
+
+void shells_row(fftw_complex *in1, fftw_complex *in2, double *w1, double *w2, uint16_t *shell, int64_t index, int64_t n){
+  active->shells(in1, in2, w1, w2, shell, index, n);
+  return;
+}
@@ -0,0 +1,51 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+// Inclusions
+#include <stdio.h>
+#include <signal.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <complex.h>
+#include <fftw3.h>
+
+// Vector kernels are written for double - single precision builds use the scalar kernels
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(SINGLE_PRECISION)
+#define X86_KERNELS
+#include <immintrin.h>
+#endif
+
+// Padding between split planes in values - keeps real and imaginary parts off the same 4 KiB offsets
+#define SPLIT_PAD 8
+
+// Fourier kernel table for one instruction set and storage
+typedef struct{
+  void (*scale)(fftw_complex *in, fftw_complex *out, double *table, uint32_t *r2, int64_t index, int64_t n);
+  void (*pair)(fftw_complex *in1, fftw_complex *in2, fftw_complex *out1, fftw_complex *out2, double *table, uint32_t *r2, int64_t index, int64_t n, csum *sums);
+  void (*corr)(fftw_complex *in1, fftw_complex *in2, int64_t index, int64_t n, csum *sums);
+  void (*add)(fftw_complex *in, fftw_complex *out, int64_t index, int64_t n);
+  void (*spectra)(fftw_complex *in1, fftw_complex *in2, uint16_t *shell, int64_t index, int64_t n, csum *out1, csum *out2, csum *nom, csum *dn1, csum *dn2, int32_t *count);
+  void (*shells)(fftw_complex *in1, fftw_complex *in2, double *w1, double *w2, uint16_t *shell, int64_t index, int64_t n);
+  char *name;
+} kernels;
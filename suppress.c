@@ -24,49 +24,46 @@
 #include "suppress.h"
 
 // Normalise between in/out
-double normalise(double *in1, double *in2, double *out1, double *out2, r_mrc *mask, list *node, int32_t size, int32_t nthreads){
+double normalise(real_t *in1, real_t *in2, real_t *out1, real_t *out2, r_mrc *mask, list *node, int32_t size, int32_t pitch, int32_t nthreads){
   int32_t i, max = size * size * size;
-  pthread_t threads[nthreads];
+  sched work;
+  // Blocks of rows - inverse transformed rows may be padded
+  init_sched(&work, (int64_t) size * size, 1, nthreads, STATIC_SCHED);
   // Calculate mean noise and mean signal
   cns_arg arg1[nthreads];
-  // Start threads
+  // Set thread arguments
   for (i = 0; i < nthreads; i++){
     arg1[i].mask = mask;
     arg1[i].in1 = in1;
     arg1[i].in2 = in2;
-    arg1[i].count = 0.0;
-    arg1[i].noise = 0.0;
-    arg1[i].power = 0.0;
     arg1[i].size = max;
-    arg1[i].step = nthreads;
+    arg1[i].row = size;
+    arg1[i].pitch = pitch;
+    arg1[i].work = &work;
     arg1[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) calc_noise_signal_thread, &arg1[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
   }
-  long double count = 0.0;
-  long double noise = 0.0;
-  long double power = 0.0;
-  // Join threads
+  // Run threads on pool
+  run_pool((void*) calc_noise_signal_thread, arg1, sizeof(arg1[0]), nthreads);
+  csum sums[2] = {{0.0, 0.0}, {0.0, 0.0}};
+  double count = 0.0;
+  // Merge thread results - counts are whole numbers so sum exactly
   for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
-    }
     count += arg1[i].count;
-    noise += arg1[i].noise;
-    power += arg1[i].power;
+    merge_sum(&sums[0], &arg1[i].noise);
+    merge_sum(&sums[1], &arg1[i].power);
+  }
+  double noise = get_sum(&sums[0]) / count;
+  double power = get_sum(&sums[1]) / count;
+  double psnr = fabs(1.0 - noise / power);
+  node->pwr = sqrt(power);
+  node->max = psnr;
+  if (!out1){
+    // Correction is applied later in Fourier space
+    return psnr;
   }
-  noise /= count;
-  power /= count;
-  double psnr = fabsl(1.0 - noise / power);
-  node->pwr = sqrtl(power);
   // Correct according to probability and power
   prob_arg arg2[nthreads];
-  // Start threads
+  // Set thread arguments
   for (i = 0; i < nthreads; i++){
     arg2[i].mask = mask;
     arg2[i].in1 = in1;
@@ -75,63 +72,257 @@ double normalise(double *in1, double *in2, double *out1, double *out2, r_mrc *ma
     arg2[i].out2 = out2;
     arg2[i].rstp = node->stp;
     arg2[i].rmsd = node->pwr;
-    arg2[i].size = max;
-    arg2[i].step = nthreads;
+    arg2[i].row = size;
+    arg2[i].pitch = pitch;
+    arg2[i].work = &work;
     arg2[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) probability_correct_thread, &arg2[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
-  }
-  node->max = psnr;
-  // Join threads
-  for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
-    }
   }
+  // Run threads on pool
+  run_pool((void*) probability_correct_thread, arg2, sizeof(arg2[0]), nthreads);
   return psnr;
 }
 
 void calc_noise_signal_thread(cns_arg *arg){
-  int32_t i;
-  double cur;
-  for (i = arg->thread; i < arg->size; i += arg->step){
-    // Normalise input transforms first
-    arg->in1[i] = arg->in1[i] / arg->size;
-    arg->in2[i] = arg->in2[i] / arg->size;
-    // Do not calculate statistics from voxels outside the mask
-    if (arg->mask->data[i] < 0.99){
-      continue;
+  int64_t r, start = -1, end = -1;
+  int32_t i, j, k, stop, lanes;
+  double cur, m, total = 0.0, count[REDUCE_LANES], noise[REDUCE_LANES], power[REDUCE_LANES];
+  real_t *in1, *in2;
+  float *mask;
+  csum sums[2] = {{0.0, 0.0}, {0.0, 0.0}};
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for (r = start; r < end; r++){
+      in1 = arg->in1 + r * arg->pitch;
+      in2 = arg->in2 + r * arg->pitch;
+      mask = arg->mask->data + r * arg->row;
+      // Short blocks summed plainly across lanes then folded into compensated sums
+      for (i = 0; i < arg->row; i = stop){
+        stop = (i + REDUCE_BLOCK < arg->row) ? i + REDUCE_BLOCK : arg->row;
+        for (k = 0; k < REDUCE_LANES; k++){
+          count[k] = noise[k] = power[k] = 0.0;
+        }
+        for (j = i; j < stop; j += REDUCE_LANES){
+          lanes = (stop - j < REDUCE_LANES) ? stop - j : REDUCE_LANES;
+          for (k = 0; k < lanes; k++){
+            // Normalise input transforms first
+            in1[j + k] = in1[j + k] / arg->size;
+            in2[j + k] = in2[j + k] / arg->size;
+            // Voxels outside the mask carry no weight in the statistics
+            m = (mask[j + k] < 0.99) ? 0.0 : 1.0;
+            count[k] += m;
+            cur = in1[j + k] - in2[j + k];
+            noise[k] += m * cur * cur;
+            cur = in1[j + k] + in2[j + k];
+            power[k] += m * cur * cur;
+          }
+        }
+        for (k = 0; k < REDUCE_LANES; k++){
+          total += count[k];
+          add_sum(&sums[0], noise[k]);
+          add_sum(&sums[1], power[k]);
+        }
+      }
     }
-    arg->count += 1.0;
-    cur = arg->in1[i] - arg->in2[i];
-    arg->noise += cur * cur;
-    cur = arg->in1[i] + arg->in2[i];
-    arg->power += cur * cur;
   }
+  // Write back once per thread
+  arg->count = total;
+  arg->noise = sums[0];
+  arg->power = sums[1];
   return;
 }
 
 void probability_correct_thread(prob_arg *arg){
+  int64_t r, in, out, start = -1, end = -1;
   int32_t i;
   double res_stp_sd = arg->rstp / arg->rmsd;
-  for (i = arg->thread; i < arg->size; i += arg->step){
-    arg->out1[i] += arg->in1[i] * res_stp_sd;
-    arg->out2[i] += arg->in2[i] * res_stp_sd;
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for (r = start; r < end; r++){
+      in = r * arg->pitch;
+      out = r * arg->row;
+      for (i = 0; i < arg->row; i++){
+        arg->out1[out + i] += arg->in1[in + i] * res_stp_sd;
+        arg->out2[out + i] += arg->in2[in + i] * res_stp_sd;
+      }
+    }
+  }
+  return;
+}
+
+// Whole-box statistics by Parseval - the filter is radial so sums run over radii
+double profile_norm(profile *prof, list *node, int32_t full){
+  double hires = node->res + node->stp;
+  double lores = (node->res == 0.0) ? -1.0 : node->res * node->res;
+  filter *table = get_filter(full, hires * hires, lores);
+  uint32_t r2, hi = (table->hi < (uint32_t) prof->radii) ? table->hi : (uint32_t) (prof->radii - 1);
+  double count = (double) full * full * full, w2;
+  csum sums[2] = {{0.0, 0.0}, {0.0, 0.0}};
+  for (r2 = table->lo; r2 <= hi; r2++){
+    w2 = table->table[r2] * table->table[r2];
+    add_sum(&sums[0], w2 * get_sum(&prof->dif[r2]));
+    add_sum(&sums[1], w2 * get_sum(&prof->sum[r2]));
+  }
+  put_filter(table);
+  // Spectral sums are count times the voxel sums, then take the mean
+  double noise = get_sum(&sums[0]) / (count * count);
+  double power = get_sum(&sums[1]) / (count * count);
+  double psnr = fabs(1.0 - noise / power);
+  node->pwr = sqrt(power);
+  node->max = psnr;
+  return psnr;
+}
+
+// Filter, correlate and transform the shell at node
+void filter_shell(shell *arg){
+  double hires = arg->node->res + arg->node->stp;
+  double lores = (arg->node->res == 0.0) ? -1.0 : arg->node->res * arg->node->res;
+  filter *table = get_filter(arg->size, hires * hires, lores);
+  if (arg->whole){
+    // Whole-box statistics need neither filtered maps nor transforms
+    arg->node->fsc = profile_fsc(arg->prof, table);
+    put_filter(table);
+    arg->node->crf = sqrt(fabs((2.0 * arg->node->fsc) / (1.0 + arg->node->fsc)));
+    return;
+  }
+  if (!arg->prof){
+    // Both halves are filtered and correlated in one sweep
+    arg->node->fsc = filter_pair(arg->ki1, arg->ki2, arg->ko1, arg->ko2, table, 1, arg->size, arg->fourier);
+  } else if (arg->check < 0.0){
+    // Filter is radial so the FSC follows from the radial profile
+    filter_pair(arg->ki1, arg->ki2, arg->ko1, arg->ko2, table, 0, arg->size, arg->fourier);
+    arg->node->fsc = profile_fsc(arg->prof, table);
+  } else {
+    // Check profile FSC against the full sum
+    arg->node->fsc = profile_fsc(arg->prof, table);
+    double diff = fabs(arg->node->fsc - filter_pair(arg->ki1, arg->ki2, arg->ko1, arg->ko2, table, 1, arg->size, arg->fourier));
+    if (diff > arg->check){
+      printf("\t Warning - profile FSC differs from full sum by %e at %12.6Lf \n", diff, arg->apix / (arg->node->res + arg->node->stp));
+    }
+    arg->worst = (diff > arg->worst) ? diff : arg->worst;
+  }
+  // Nothing lies beyond the band so its columns need no transforms
+  uint32_t hi = table->hi;
+  put_filter(table);
+  arg->node->crf = sqrt(fabs((2.0 * arg->node->fsc) / (1.0 + arg->node->fsc)));
+  // Low resolution shells need only their coarse box for the statistics
+  arg->grid = coarse_shell(arg, hi);
+  if (!arg->grid){
+    execute_band(arg->fft1, arg->fft2, hi, arg->inside);
+  }
+  return;
+}
+
+// Normalise current shell while the guessed next shell is filtered
+double pass_ahead(shell *batch, real_t *out1, real_t *out2, int8_t ready){
+  ahead_arg arg[2];
+  // Set thread arguments
+  arg[0].sh = &batch[0];
+  arg[0].out1 = out1;
+  arg[0].out2 = out2;
+  arg[0].filter = !ready;
+  arg[0].norm = 1;
+  arg[0].mean_p = 0.0;
+  arg[1].sh = &batch[1];
+  arg[1].filter = 1;
+  arg[1].norm = 0;
+  // Only look ahead if there is a guess
+  if (batch[1].node){
+    run_split((void*) ahead_thread, arg, sizeof(arg[0]));
+  } else {
+    ahead_thread(&arg[0]);
+  }
+  return arg[0].mean_p;
+}
+
+void ahead_thread(ahead_arg *arg){
+  shell *sh = arg->sh;
+  if (arg->filter){
+    filter_shell(sh);
+  }
+  if (arg->norm && sh->whole){
+    arg->mean_p = profile_norm(sh->prof, sh->node, sh->size);
+  } else if (arg->norm && sh->grid){
+    arg->mean_p = coarse_norm(sh);
+  } else if (arg->norm){
+    arg->mean_p = normalise(sh->ri1, sh->ri2, arg->out1, arg->out2, sh->mask, sh->node, sh->size, real_pitch(sh->size), sh->real);
+  }
+  return;
+}
+
+// Normalising and reverting are linear so the shells sum to one radial filter
+filter *composite_filter(list *head, int8_t revert, int32_t full){
+  int32_t half = full / 2;
+  int64_t r2, radii = 3 * (int64_t) half * half + 1;
+  double hires, lores, res_stp_sd;
+  filter *arg = malloc(sizeof(filter)), *table;
+  list *node;
+  arg->table = calloc(radii, sizeof(double));
+  arg->lo = 1;
+  arg->hi = 0;
+  for (node = head; node; node = node->nxt){
+    hires = node->res + node->stp;
+    lores = (node->res == 0.0) ? -1.0 : node->res * node->res;
+    table = get_filter(full, hires * hires, lores);
+    // Same weight as probability_correct_thread multiplies and revert_thread divides by
+    res_stp_sd = node->stp / node->pwr;
+    if (revert){
+      res_stp_sd = 1.0 / res_stp_sd;
+    }
+    for (r2 = table->lo; r2 <= table->hi && r2 < radii; r2++){
+      arg->table[r2] += table->table[r2] * res_stp_sd;
+    }
+    if (table->lo <= table->hi){
+      arg->lo = (arg->lo > arg->hi || table->lo < arg->lo) ? table->lo : arg->lo;
+      arg->hi = (table->hi > arg->hi) ? table->hi : arg->hi;
+    }
+    put_filter(table);
+  }
+  return arg;
+}
+
+// Bandpass, transform and revert shells into out1/2
+void reapply_shells(shell *batch, int32_t nshells, real_t *out1, real_t *out2){
+  fftw_complex *ko1[SHELL_BATCH], *ko2[SHELL_BATCH];
+  filter *table[SHELL_BATCH];
+  double hires, lores;
+  shell *sh;
+  int32_t i;
+  for (i = 0; i < nshells; i++){
+    hires = batch[i].node->res + batch[i].node->stp;
+    lores = (batch[i].node->res == 0.0) ? -1.0 : batch[i].node->res * batch[i].node->res;
+    table[i] = get_filter(batch->size, hires * hires, lores);
+    ko1[i] = batch[i].ko1;
+    ko2[i] = batch[i].ko2;
+  }
+  if (batch->ring){
+    // Ring shells share one sweep over the input and one plan per half
+    filter_batch(batch->ki1, batch->ki2, ko1, ko2, table, nshells, batch->size, batch->fourier);
+    if (nshells == batch->rest){
+      // A short last batch transforms only the shells it holds
+      execute_halves(batch->rest1, batch->rest2);
+    } else {
+      execute_halves(batch->fft1, batch->fft2);
+    }
+  }
+  for (i = 0; i < nshells; i++){
+    // Outside a ring every shell reuses the maps and plans of the first
+    sh = batch->ring ? &batch[i] : batch;
+    if (!batch->ring){
+      filter_pair(batch->ki1, batch->ki2, sh->ko1, sh->ko2, table[i], 0, batch->size, batch->fourier);
+      execute_halves(sh->fft1, sh->fft2);
+    }
+    put_filter(table[i]);
+    reverse_norm(sh->ri1, sh->ri2, out1, out2, batch->mask, batch[i].node, batch->size, batch->real);
   }
   return;
 }
 
 // Undo normalisation between in/out
-void reverse_norm(double *in1, double *in2, double *out1, double *out2, r_mrc *mask, list *node, int32_t size, int32_t nthreads){
-  int32_t i, max = size * size * size;
-  pthread_t threads[nthreads];
+void reverse_norm(real_t *in1, real_t *in2, real_t *out1, real_t *out2, r_mrc *mask, list *node, int32_t size, int32_t nthreads){
+  int32_t i;
+  sched work;
+  // Blocks of rows as in normalise
+  init_sched(&work, (int64_t) size * size, 1, nthreads, STATIC_SCHED);
   prob_arg arg[nthreads];
-  // Start threads
+  // Set thread arguments
   for (i = 0; i < nthreads; i++){
     arg[i].in1 = in1;
     arg[i].in2 = in2;
@@ -139,33 +330,30 @@ void reverse_norm(double *in1, double *in2, double *out1, double *out2, r_mrc *m
     arg[i].out2 = out2;
     arg[i].rstp = node->stp;
     arg[i].rmsd = node->pwr;
-    arg[i].size = max;
-    arg[i].step = nthreads;
+    arg[i].row = size;
+    arg[i].pitch = real_pitch(size);
+    arg[i].work = &work;
     arg[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) revert_thread, &arg[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
-  }
-  // Join threads
-  for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
-    }
   }
+  // Run threads on pool
+  run_pool((void*) revert_thread, arg, sizeof(arg[0]), nthreads);
   return;
 }
 
 void revert_thread(prob_arg *arg){
+  int64_t r, in, out, start = -1, end = -1;
   int32_t i;
   double res_stp_sd = arg->rstp / arg->rmsd;
-  for (i = arg->thread; i < arg->size; i += arg->step){
-    // Correct output
-    arg->out1[i] += arg->in1[i] / res_stp_sd;
-    arg->out2[i] += arg->in2[i] / res_stp_sd;
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for (r = start; r < end; r++){
+      in = r * arg->pitch;
+      out = r * arg->row;
+      for (i = 0; i < arg->row; i++){
+        // Correct output
+        arg->out1[out + i] += arg->in1[in + i] / res_stp_sd;
+        arg->out2[out + i] += arg->in2[in + i] / res_stp_sd;
+      }
+    }
   }
   return;
 }
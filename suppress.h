@@ -34,29 +34,42 @@
 // Noise and signal power thread arguments structure
 typedef struct{
   r_mrc       *mask;
-  double       *in1;
-  double       *in2;
-  long double count;
-  long double noise;
-  long double power;
+  real_t       *in1;
+  real_t       *in2;
+  double      count;
+  csum        noise;
+  csum        power;
   int32_t      size;
-  int32_t      step;
+  int32_t       row;
+  int32_t     pitch;
+  sched       *work;
   int32_t    thread;
-} cns_arg;
+} CACHE_ALIGN cns_arg;
 
 // Probabilistic correction thread arguments structure
 typedef struct{
   r_mrc       *mask;
-  double       *in1;
-  double       *in2;
-  double      *out1;
-  double      *out2;
+  real_t       *in1;
+  real_t       *in2;
+  real_t      *out1;
+  real_t      *out2;
   long double  rstp;
   long double  rmsd;
-  int32_t      size;
-  int32_t      step;
+  int32_t       row;
+  int32_t     pitch;
+  sched       *work;
   int32_t    thread;
-} prob_arg;
+} CACHE_ALIGN prob_arg;
+
+// Look-ahead thread arguments structure
+typedef struct{
+  shell         *sh;
+  real_t      *out1;
+  real_t      *out2;
+  double     mean_p;
+  int8_t     filter;
+  int8_t       norm;
+} CACHE_ALIGN ahead_arg;
 
 void calc_noise_signal_thread(cns_arg *arg);
 // Calculate noise and signal power
@@ -69,3 +82,7 @@ void probability_correct_thread(prob_arg *arg);
 void revert_thread(prob_arg *arg);
 // Revert to original power
 // pthread function
+
+void ahead_thread(ahead_arg *arg);
+// Filter and or normalise one shell
+// pthread function
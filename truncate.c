@@ -23,224 +23,332 @@
 #include "sidesplitter.h"
 #include "truncate.h"
 
-// Updates out if in1/2 over noise - returns fractional recovery
-double truncate_map(double *in1, double *in2, double *out1, double *out2, r_mrc *mask, list *node, arguments *args, int32_t size, int32_t nthreads){
-  int32_t i, m, n, full = size * size * size;
-  double cor, cur;
-  // Calculate max noise
-  pthread_t threads[nthreads];
-  max_arg arg1[nthreads];
-  // Start threads
-  for (i = 0; i < nthreads; i++){
-    arg1[i].mask = mask;
-    arg1[i].in1 = in1;
-    arg1[i].in2 = in2;
-    arg1[i].noise = 0.0;
-    arg1[i].sigma = 0.0;
-    arg1[i].count = 0.0;
-    arg1[i].size = full;
-    arg1[i].step = nthreads;
-    arg1[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) calc_max_noise_thread, &arg1[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
+// Filter, transform and find the noise level for up to two shells at once
+void run_shells(shell *batch, int32_t nshells){
+  if (batch->ring){
+    // Ring shells share one sweep over the input
+    ring_shells(batch, nshells);
+  } else if (nshells > 1){
+    // Each shell runs on its own group if split
+    run_split((void*) shell_thread, batch, sizeof(batch[0]));
+  } else {
+    shell_thread(batch);
   }
-  double count = 0.0;
-  double noise = 0.0;
-  long double sigma = 0.0;
-  // Join threads
-  for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
-    }
-    count += arg1[i].count;
-    sigma += arg1[i].sigma;
-    if (noise < arg1[i].noise){
-      noise = arg1[i].noise;
-    }
+  return;
+}
+
+void shell_thread(shell *arg){
+  double hires = arg->node->res + arg->node->stp;
+  filter *table = get_filter(arg->size, hires * hires, -1.0);
+  filter_pair(arg->ki1, arg->ki2, arg->ko1, arg->ko2, table, 0, arg->size, arg->fourier);
+  if (arg->pk1){
+    // Unmasked maps supply the values when tapering
+    filter_pair(arg->pk1, arg->pk2, arg->oko1, arg->oko2, table, 0, arg->size, arg->fourier);
   }
-  // Take normal estimate of maximum if higher
-  sigma = sqrtl(sigma / (long double) count);
-  sigma = sigma * sqrtl(2.0) * sqrtl(logl((long double) count));
-  sigma = sigma * sigma;
-  if (noise < (double) sigma){
-    noise = (double) sigma;
+  // Nothing lies beyond the band so its columns need no transforms
+  execute_pruned(arg->fft1, table->hi, 0);
+  execute_pruned(arg->fft2, table->hi, 0);
+  if (arg->pk1){
+    execute_pruned(arg->fft3, table->hi, 0);
+    execute_pruned(arg->fft4, table->hi, 0);
   }
-  // Pass through signal greater than noise
-  ass_vox_arg arg2[nthreads];
-  // Start threads
-  for (i = 0; i < nthreads; i++){
-    arg2[i].in1 = in1;
-    arg2[i].in2 = in2;
-    arg2[i].out1 = out1;
-    arg2[i].out2 = out2;
-    arg2[i].noise = noise;
-    arg2[i].rcv = 0.0;
-    arg2[i].size = full;
-    arg2[i].step = nthreads;
-    arg2[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) assign_voxels_thread, &arg2[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
+  put_filter(table);
+  arg->noise = shell_noise(arg->ri1, arg->ri2, arg->mask, &arg->count, arg->size, arg->real);
+  return;
+}
+
+// Lowpass all shells of the ring in one sweep and transform them together
+void ring_shells(shell *batch, int32_t nshells){
+  fftw_complex *out1[SHELL_BATCH], *out2[SHELL_BATCH];
+  filter *table[SHELL_BATCH];
+  double hires;
+  int32_t i;
+  for (i = 0; i < nshells; i++){
+    hires = batch[i].node->res + batch[i].node->stp;
+    table[i] = get_filter(batch->size, hires * hires, -1.0);
+  }
+  for (i = 0; i < nshells; i++){
+    out1[i] = batch[i].ko1;
+    out2[i] = batch[i].ko2;
+  }
+  filter_batch(batch->ki1, batch->ki2, out1, out2, table, nshells, batch->size, batch->fourier);
+  if (batch->pk1){
+    // Unmasked maps supply the values when tapering
+    for (i = 0; i < nshells; i++){
+      out1[i] = batch[i].oko1;
+      out2[i] = batch[i].oko2;
     }
+    filter_batch(batch->pk1, batch->pk2, out1, out2, table, nshells, batch->size, batch->fourier);
   }
-  double rcv = 0.0;
-  // Join threads
-  for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
+  for (i = 0; i < nshells; i++){
+    put_filter(table[i]);
+  }
+  // A short last batch transforms only the shells it holds
+  if (nshells == batch->rest){
+    execute_halves(batch->rest1, batch->rest2);
+  } else {
+    execute_halves(batch->fft1, batch->fft2);
+  }
+  if (batch->pk1 && nshells == batch->rest){
+    execute_halves(batch->rest3, batch->rest4);
+  } else if (batch->pk1){
+    execute_halves(batch->fft3, batch->fft4);
+  }
+  for (i = 0; i < nshells; i++){
+    batch[i].noise = shell_noise(batch[i].ri1, batch[i].ri2, batch[i].mask, &batch[i].count, batch[i].size, batch[i].real);
+  }
+  return;
+}
+
+// Ring shells are consecutive maps after those of the first shell
+void alloc_ring(shell *batch, int32_t nshells, int32_t rest, int8_t taper, int32_t fft_threads){
+  int64_t k_sz = fourier_stride(batch->size);
+  int64_t r_sz = real_stride(batch->size);
+  int32_t i;
+  if (taper && !batch->oko1){
+    batch->oko1 = alloc_fouriers(batch->size, nshells, batch->fourier);
+    batch->oko2 = alloc_fouriers(batch->size, nshells, batch->fourier);
+    // In place the shell maps overwrite their half transforms
+    batch->ori1 = inplace_layout() ? (real_t *) batch->oko1 : alloc_reals(batch->size, nshells, batch->real);
+    batch->ori2 = inplace_layout() ? (real_t *) batch->oko2 : alloc_reals(batch->size, nshells, batch->real);
+  }
+  for (i = 0; i < nshells; i++){
+    batch[i].ring = nshells;
+    batch[i].ko1 = batch->ko1 + i * k_sz;
+    batch[i].ko2 = batch->ko2 + i * k_sz;
+    batch[i].ri1 = batch->ri1 + i * r_sz;
+    batch[i].ri2 = batch->ri2 + i * r_sz;
+    if (taper){
+      batch[i].oko1 = batch->oko1 + i * k_sz;
+      batch[i].oko2 = batch->oko2 + i * k_sz;
+      batch[i].ori1 = batch->ori1 + i * r_sz;
+      batch[i].ori2 = batch->ori2 + i * r_sz;
     }
-    rcv += arg2[i].rcv;
   }
-  return rcv / count;
+  // One plan per half transforms every shell of the ring
+  fftw_plan_with_nthreads(split_threads(0, fft_threads));
+  batch->fft1 = plan_c2r_many(batch->size, nshells, batch->ko1, batch->ri1, plan_effort() | FFTW_WISDOM_ONLY);
+  fftw_plan_with_nthreads(split_threads(1, fft_threads));
+  batch->fft2 = plan_c2r_many(batch->size, nshells, batch->ko2, batch->ri2, plan_effort() | FFTW_WISDOM_ONLY);
+  if (taper){
+    fftw_plan_with_nthreads(split_threads(0, fft_threads));
+    batch->fft3 = plan_c2r_many(batch->size, nshells, batch->oko1, batch->ori1, plan_effort() | FFTW_WISDOM_ONLY);
+    fftw_plan_with_nthreads(split_threads(1, fft_threads));
+    batch->fft4 = plan_c2r_many(batch->size, nshells, batch->oko2, batch->ori2, plan_effort() | FFTW_WISDOM_ONLY);
+  }
+  // Shells left over after the last whole ring
+  batch->rest = rest;
+  if (!rest){
+    return;
+  }
+  fftw_plan_with_nthreads(split_threads(0, fft_threads));
+  batch->rest1 = plan_c2r_many(batch->size, rest, batch->ko1, batch->ri1, plan_effort() | FFTW_WISDOM_ONLY);
+  fftw_plan_with_nthreads(split_threads(1, fft_threads));
+  batch->rest2 = plan_c2r_many(batch->size, rest, batch->ko2, batch->ri2, plan_effort() | FFTW_WISDOM_ONLY);
+  if (taper){
+    fftw_plan_with_nthreads(split_threads(0, fft_threads));
+    batch->rest3 = plan_c2r_many(batch->size, rest, batch->oko1, batch->ori1, plan_effort() | FFTW_WISDOM_ONLY);
+    fftw_plan_with_nthreads(split_threads(1, fft_threads));
+    batch->rest4 = plan_c2r_many(batch->size, rest, batch->oko2, batch->ori2, plan_effort() | FFTW_WISDOM_ONLY);
+  }
+  return;
+}
+
+// Allocate any buffers and plans the shell does not yet have
+void alloc_shell(shell *arg, int8_t taper, int32_t fft_threads){
+  if (!arg->ko1){
+    arg->ko1 = alloc_fourier(arg->size, arg->fourier);
+    arg->ko2 = alloc_fourier(arg->size, arg->fourier);
+    // In place the shell maps overwrite their half transforms
+    arg->ri1 = inplace_layout() ? (real_t *) arg->ko1 : alloc_real(arg->size, arg->real);
+    arg->ri2 = inplace_layout() ? (real_t *) arg->ko2 : alloc_real(arg->size, arg->real);
+  }
+  if (taper && !arg->oko1){
+    arg->oko1 = alloc_fourier(arg->size, arg->fourier);
+    arg->oko2 = alloc_fourier(arg->size, arg->fourier);
+    arg->ori1 = inplace_layout() ? (real_t *) arg->oko1 : alloc_real(arg->size, arg->real);
+    arg->ori2 = inplace_layout() ? (real_t *) arg->oko2 : alloc_real(arg->size, arg->real);
+  }
+  fftw_plan_with_nthreads(fft_threads);
+  if (!arg->fft1){
+    arg->fft1 = plan_c2r(arg->size, arg->ko1, arg->ri1, plan_effort() | FFTW_WISDOM_ONLY);
+    arg->fft2 = plan_c2r(arg->size, arg->ko2, arg->ri2, plan_effort() | FFTW_WISDOM_ONLY);
+  }
+  if (taper && !arg->fft3){
+    arg->fft3 = plan_c2r(arg->size, arg->oko1, arg->ori1, plan_effort() | FFTW_WISDOM_ONLY);
+    arg->fft4 = plan_c2r(arg->size, arg->oko2, arg->ori2, plan_effort() | FFTW_WISDOM_ONLY);
+  }
+  // Ignored unless pruning
+  prune_plan(arg->fft1, arg->ko1, arg->ri1, arg->size, fft_threads);
+  prune_plan(arg->fft2, arg->ko2, arg->ri2, arg->size, fft_threads);
+  if (taper){
+    prune_plan(arg->fft3, arg->oko1, arg->ori1, arg->size, fft_threads);
+    prune_plan(arg->fft4, arg->oko2, arg->ori2, arg->size, fft_threads);
+  }
+  return;
 }
 
-// Updates out if in1/2 over noise - returns fractional recovery
-double taper_map(double *in1, double *in2, double *out1, double *out2, double *ori1, double *ori2, r_mrc *mask, list *node, arguments *args, int32_t size, int32_t nthreads){
-  int32_t i, m, n, full = size * size * size;
-  double cor, cur;
+// Normalise in1/2 and return the noise threshold for their shell
+double shell_noise(real_t *in1, real_t *in2, r_mrc *mask, double *count, int32_t size, int32_t nthreads){
+  int32_t i, full = size * size * size;
+  sched work;
+  // Blocks of rows - inverse transformed rows may be padded
+  init_sched(&work, (int64_t) size * size, 1, nthreads, STATIC_SCHED);
   // Calculate max noise
-  pthread_t threads[nthreads];
-  max_arg arg1[nthreads];
-  // Start threads
+  max_arg arg[nthreads];
+  // Set thread arguments
   for (i = 0; i < nthreads; i++){
-    arg1[i].mask = mask;
-    arg1[i].in1 = in1;
-    arg1[i].in2 = in2;
-    arg1[i].noise = 0.0;
-    arg1[i].sigma = 0.0;
-    arg1[i].count = 0.0;
-    arg1[i].size = full;
-    arg1[i].step = nthreads;
-    arg1[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) calc_max_noise_thread, &arg1[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
+    arg[i].mask = mask;
+    arg[i].in1 = in1;
+    arg[i].in2 = in2;
+    arg[i].size = full;
+    arg[i].row = size;
+    arg[i].pitch = real_pitch(size);
+    arg[i].work = &work;
+    arg[i].thread = i;
   }
-  double count = 0.0;
-  double noise = 0.0;
-  long double sigma = 0.0;
-  // Join threads
+  // Run threads on pool
+  run_pool((void*) calc_max_noise_thread, arg, sizeof(arg[0]), nthreads);
+  double noise = 0.0, sigma;
+  csum sum = {0.0, 0.0};
+  *count = 0.0;
+  // Merge thread results
   for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
-    }
-    count += arg1[i].count;
-    sigma += arg1[i].sigma;
-    if (noise < arg1[i].noise){
-      noise = arg1[i].noise;
+    *count += arg[i].count;
+    merge_sum(&sum, &arg[i].sigma);
+    if (noise < arg[i].noise){
+      noise = arg[i].noise;
     }
   }
   // Take normal estimate of maximum if higher
-  sigma = sqrtl(sigma / (long double) count);
-  sigma = sigma * sqrtl(2.0) * sqrtl(logl((long double) count));
+  sigma = sqrt(get_sum(&sum) / *count);
+  sigma = sigma * sqrt(2.0) * sqrt(log(*count));
   sigma = sigma * sigma;
-  if (noise < (double) sigma){
-    noise = (double) sigma;
+  if (noise < sigma){
+    noise = sigma;
   }
-  // Pass through signal greater than noise
-  ass_vox_arg arg2[nthreads];
-  // Start threads
+  return noise;
+}
+
+// Record the first shell each voxel crosses its noise threshold
+void first_crossing(shell *batch, int32_t nshells, uint16_t base, real_t *out1, real_t *out2, uint16_t *first1, uint16_t *first2, double *hits, int8_t taper, int32_t size, int32_t nthreads){
+  int32_t i, j;
+  sched work;
+  // Blocks of rows as in shell_noise
+  init_sched(&work, (int64_t) size * size, 1, nthreads, STATIC_SCHED);
+  cross_arg arg[nthreads];
+  // Set thread arguments
   for (i = 0; i < nthreads; i++){
-    arg2[i].in1 = in1;
-    arg2[i].in2 = in2;
-    arg2[i].out1 = out1;
-    arg2[i].out2 = out2;
-    arg2[i].ori1 = ori1;
-    arg2[i].ori2 = ori2;
-    arg2[i].noise = noise;
-    arg2[i].rcv = 0.0;
-    arg2[i].size = full;
-    arg2[i].step = nthreads;
-    arg2[i].thread = i;
-    if (pthread_create(&threads[i], NULL, (void*) taper_voxels_thread, &arg2[i])){
-      printf("\nThread initialisation failed!\n");
-      fflush(stdout);
-      exit(1);
-    }
+    arg[i].batch = batch;
+    arg[i].out1 = out1;
+    arg[i].out2 = out2;
+    arg[i].first1 = first1;
+    arg[i].first2 = first2;
+    arg[i].nshells = nshells;
+    arg[i].base = base;
+    arg[i].taper = taper;
+    arg[i].row = size;
+    arg[i].pitch = real_pitch(size);
+    arg[i].work = &work;
+    arg[i].thread = i;
   }
-  double rcv = 0.0;
-  // Join threads
-  for (i = 0; i < nthreads; i++){
-    if (pthread_join(threads[i], NULL)){
-      printf("\nThread failed during run!\n");
-      fflush(stdout);
-      exit(1);
+  // Run threads on pool
+  run_pool((void*) first_crossing_thread, arg, sizeof(arg[0]), nthreads);
+  // Merge thread results
+  for (j = 0; j < nshells; j++){
+    hits[j] = 0.0;
+    for (i = 0; i < nthreads; i++){
+      hits[j] += arg[i].hits[j];
     }
-    rcv += arg2[i].rcv;
   }
-  return rcv / count;
+  return;
 }
 
 void calc_max_noise_thread(max_arg *arg){
-  int32_t i;
-  double cor, cur;
-  for (i = arg->thread; i < arg->size; i += arg->step){
-    // Normalise input transforms first
-    arg->in1[i] = arg->in1[i] / arg->size;
-    arg->in2[i] = arg->in2[i] / arg->size;
-    // Do not calculate statistics from voxels outside the mask
-    if (arg->mask->data[i] < 0.99){
-      continue;
-    }
-    arg->count += 1.0;
-    cur = 0.5 * (arg->in1[i] - arg->in2[i]);
-    cor = cur * cur;
-    if (cor > arg->noise){
-      arg->noise = cor;
+  int64_t r, start = -1, end = -1;
+  int32_t i, j, k, stop, lanes;
+  double cor, cur, m, peak = 0.0, total = 0.0, noise[REDUCE_LANES], count[REDUCE_LANES], sigma[REDUCE_LANES];
+  real_t *in1, *in2;
+  float *mask;
+  csum sum = {0.0, 0.0};
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for (r = start; r < end; r++){
+      in1 = arg->in1 + r * arg->pitch;
+      in2 = arg->in2 + r * arg->pitch;
+      mask = arg->mask->data + r * arg->row;
+      // Blocked over lanes as in calc_noise_signal_thread
+      for (i = 0; i < arg->row; i = stop){
+        stop = (i + REDUCE_BLOCK < arg->row) ? i + REDUCE_BLOCK : arg->row;
+        for (k = 0; k < REDUCE_LANES; k++){
+          noise[k] = count[k] = sigma[k] = 0.0;
+        }
+        for (j = i; j < stop; j += REDUCE_LANES){
+          lanes = (stop - j < REDUCE_LANES) ? stop - j : REDUCE_LANES;
+          for (k = 0; k < lanes; k++){
+            // Normalise input transforms first
+            in1[j + k] = in1[j + k] / arg->size;
+            in2[j + k] = in2[j + k] / arg->size;
+            // Voxels outside the mask carry no weight in the statistics
+            m = (mask[j + k] < 0.99) ? 0.0 : 1.0;
+            count[k] += m;
+            cur = 0.5 * (in1[j + k] - in2[j + k]);
+            cor = m * cur * cur;
+            noise[k] = (cor > noise[k]) ? cor : noise[k];
+            sigma[k] += cor;
+          }
+        }
+        for (k = 0; k < REDUCE_LANES; k++){
+          total += count[k];
+          peak = (noise[k] > peak) ? noise[k] : peak;
+          add_sum(&sum, sigma[k]);
+        }
+      }
     }
-    arg->sigma += (long double) cor;
   }
+  // Write back once per thread
+  arg->count = total;
+  arg->noise = peak;
+  arg->sigma = sum;
   return;
 }
 
-void assign_voxels_thread(ass_vox_arg *arg){
-  int32_t i;
-  double cor, cur;
-  for (i = arg->thread; i < arg->size; i += arg->step){
-    if (fabs(arg->out1[i]) > 0.0){
-      arg->rcv += 0.5;
-    } else if ((arg->in1[i] * arg->in1[i]) > arg->noise){
-      arg->out1[i] = arg->in1[i];
-      arg->rcv += 0.5;
-    }
-    if (fabs(arg->out2[i]) > 0.0){
-      arg->rcv += 0.5;
-    } else if ((arg->in2[i] * arg->in2[i]) > arg->noise){
-      arg->out2[i] = arg->in2[i];
-      arg->rcv += 0.5;
+void first_crossing_thread(cross_arg *arg){
+  int64_t r, i, p, start = -1, end = -1;
+  int32_t j, x;
+  double hits[SHELL_BATCH] = {0.0}, val;
+  shell *sh;
+  while (next_block(arg->work, arg->thread, &start, &end)){
+    for (r = start; r < end; r++){
+      for (x = 0; x < arg->row; x++){
+        // Shell maps may be padded - outputs and first shells are not
+        i = r * arg->row + x;
+        p = r * arg->pitch + x;
+        // Shells are in resolution order so the earliest crossing wins
+        for (j = 0; j < arg->nshells; j++){
+          sh = &arg->batch[j];
+          if (!arg->first1[i] && (sh->ri1[p] * sh->ri1[p]) > sh->noise){
+            val = arg->taper ? sh->ori1[p] : sh->ri1[p];
+            if (fabs(val) > 0.0){
+              arg->out1[i] = val;
+              arg->first1[i] = arg->base + j;
+              hits[j] += 0.5;
+            }
+          }
+          if (!arg->first2[i] && (sh->ri2[p] * sh->ri2[p]) > sh->noise){
+            val = arg->taper ? sh->ori2[p] : sh->ri2[p];
+            if (fabs(val) > 0.0){
+              arg->out2[i] = val;
+              arg->first2[i] = arg->base + j;
+              hits[j] += 0.5;
+            }
+          }
+        }
+      }
     }
   }
-  return;
-}
-
-void taper_voxels_thread(ass_vox_arg *arg){
-  int32_t i;
-  double cor, cur;
-  for (i = arg->thread; i < arg->size; i += arg->step){
-    if (fabs(arg->out1[i]) > 0.0){
-      arg->rcv += 0.5;
-    } else if ((arg->in1[i] * arg->in1[i]) > arg->noise){
-      arg->out1[i] = arg->ori1[i];
-      arg->rcv += 0.5;
-    }
-    if (fabs(arg->out2[i]) > 0.0){
-      arg->rcv += 0.5;
-    } else if ((arg->in2[i] * arg->in2[i]) > arg->noise){
-      arg->out2[i] = arg->ori2[i];
-      arg->rcv += 0.5;
-    }
+  // Write back once per thread
+  for (j = 0; j < arg->nshells; j++){
+    arg->hits[j] = hits[j];
   }
   return;
 }
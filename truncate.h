@@ -34,39 +34,46 @@
 // Noise and signal power thread arguments structure
 typedef struct{
   r_mrc    *mask;
-  double    *in1;
-  double    *in2;
+  real_t    *in1;
+  real_t    *in2;
   double   noise;
   double   count;
   int32_t   size;
-  int32_t   step;
+  int32_t    row;
+  int32_t  pitch;
+  sched    *work;
   int32_t thread;
-  long double sigma;
-} max_arg;
+  csum     sigma;
+} CACHE_ALIGN max_arg;
 
-// Probabilistic correction thread arguments structure
+// First crossing thread arguments structure
 typedef struct{
-  double    *in1;
-  double    *in2;
-  double   *out1;
-  double   *out2;
-  double   *ori1;
-  double   *ori2;
-  double   noise;
-  double     rcv;
-  int32_t   size;
-  int32_t   step;
-  int32_t thread;
-} ass_vox_arg;
+  shell       *batch;
+  real_t       *out1;
+  real_t       *out2;
+  uint16_t   *first1;
+  uint16_t   *first2;
+  double hits[SHELL_BATCH];
+  int32_t    nshells;
+  uint16_t      base;
+  int8_t       taper;
+  int32_t        row;
+  int32_t      pitch;
+  sched        *work;
+  int32_t     thread;
+} CACHE_ALIGN cross_arg;
 
 void calc_max_noise_thread(max_arg *arg);
 // Calculate noise and signal power
 // pthread function
 
-void assign_voxels_thread(ass_vox_arg *arg);
-// Correct according to probability
+void first_crossing_thread(cross_arg *arg);
+// Record first shell over noise per voxel
 // pthread function
 
-void taper_voxels_thread(ass_vox_arg *arg);
-// Correct according to probability
+void ring_shells(shell *batch, int32_t nshells);
+// Filter, transform and threshold ring shells
+
+void shell_thread(shell *arg);
+// Filter, transform and threshold one shell
 // pthread function
@@ -0,0 +1,396 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Library header inclusion for linking
+#define _GNU_SOURCE
+#include "sidesplitter.h"
+#include "tune.h"
+
+// Choose thread counts per stage from profile, tuning, or default
+jobs *stage_jobs(arguments *args, r_mrc *mask, int32_t full, int32_t nthreads){
+  jobs *stage = malloc(sizeof(jobs));
+  stage->fft = nthreads;
+  stage->fourier = nthreads;
+  stage->real = nthreads;
+  if (args->tune){
+    tune_jobs(stage, mask, full, nthreads);
+    if (args->prof){
+      write_profile(args->prof, stage, full, nthreads);
+    }
+  } else if (args->prof && read_profile(args->prof, stage, full, nthreads)){
+    printf("\n\t Thread counts read from profile %s\n", args->prof);
+  }
+  printf("\n\t Threads per stage | FFT = %i | Fourier = %i | Real = %i\n", stage->fft, stage->fourier, stage->real);
+  fflush(stdout);
+  return stage;
+}
+
+// Time Fourier kernels and inverse FFT with interleaved and split storage
+void bench_layout(int8_t split, jobs *stage, int32_t full){
+  int64_t r_sz = (int64_t) full * full * full;
+  double t_fil, t_fsc, t_spec, t_fft;
+  int8_t layout;
+  printf("\n\t Benchmarking half transform storage for %i^3 maps\n\n", full);
+  fflush(stdout);
+  for (layout = 0; layout < 2; layout++){
+    set_layout(layout, full);
+    real_t *r1 = fftw_malloc(r_sz * sizeof(real_t));
+    fftw_complex *k1 = fftw_malloc(fourier_bytes(full));
+    fftw_complex *k2 = fftw_malloc(fourier_bytes(full));
+    fftw_complex *k3 = fftw_malloc(fourier_bytes(full));
+    zero_real(r1, full, stage->real);
+    zero_fourier(k1, full, stage->fourier);
+    zero_fourier(k2, full, stage->fourier);
+    zero_fourier(k3, full, stage->fourier);
+    tune_fill((real_t *) k1, fourier_bytes(full) / sizeof(real_t));
+    tune_fill((real_t *) k2, fourier_bytes(full) / sizeof(real_t));
+    t_fil = time_fourier(k1, k3, full, stage->fourier);
+    t_fsc = time_fsc(k1, k2, full, stage->fourier);
+    t_spec = time_spectrum(k1, k2, full, stage->fourier);
+    // Inverse FFT overwrites its input so runs last
+    t_fft = time_fft(k1, r1, full, stage->fft);
+    printf("\t Layout = %11s | Filter = %10.6f s | FSC = %10.6f s | Spectrum = %10.6f s | FFT = %10.6f s\n", layout ? "split" : "interleaved", t_fil, t_fsc, t_spec, t_fft);
+    fflush(stdout);
+    fftw_free(r1);
+    fftw_free(k1);
+    fftw_free(k2);
+    fftw_free(k3);
+  }
+  set_layout(split, full);
+  return;
+}
+
+// Compare kernel reductions and plain long double sums with compensated long double sums
+void check_sums(fftw_complex *half1, fftw_complex *half2, real_t *map1, real_t *map2, r_mrc *mask, jobs *stage, int32_t full){
+  geom *geo = get_geometry(full, stage->fourier);
+  int64_t r_sz = (int64_t) full * full * full, row, index;
+  int32_t size = full / 2 + 1, first, last, i, k, norms;
+  long double ref[5][2], raw[5], x[5], fsc, crf;
+  double err_ref = 0.0, err_raw = 0.0, e;
+  fftw_complex f1, f2;
+  list node;
+  printf("\n\t Checking reductions against compensated long double sums (relative errors)\n\n");
+  // FSC over the whole transform
+  memset(ref, 0, sizeof(ref));
+  memset(raw, 0, sizeof(raw));
+  for (row = 0; row < (int64_t) full * full; row++){
+    row_band(geo, row, 0, UINT32_MAX, &first, &last);
+    for (i = first; i < last; i++){
+      f1 = get_coef(half1, row * size + i);
+      f2 = get_coef(half2, row * size + i);
+      x[0] = creal(f1 * conj(f2));
+      x[1] = creal(f1 * conj(f1));
+      x[2] = creal(f2 * conj(f2));
+      for (k = 0; k < 3; k++){
+        ref_add(ref[k], x[k]);
+        raw[k] += x[k];
+      }
+    }
+  }
+  fsc = (ref[0][0] + ref[0][1]) / sqrtl(fabsl((ref[1][0] + ref[1][1]) * (ref[2][0] + ref[2][1])));
+  printf("\t FSC      | kernels = %e | long double = %e\n", rel_err(calc_fsc(half1, half2, full, stage->fourier), fsc), rel_err(raw[0] / sqrtl(fabsl(raw[1] * raw[2])), fsc));
+  // Spectrum by shell - worst shell reported
+  long double (*sref)[5][2] = calloc(full, sizeof(*sref));
+  long double (*sraw)[5] = calloc(full, sizeof(*sraw));
+  int32_t *n = calloc(full, sizeof(int32_t));
+  double *spec1 = calloc(full, sizeof(double));
+  double *spec2 = calloc(full, sizeof(double));
+  get_spectrum(half1, half2, spec1, spec2, full, stage->fourier);
+  for (row = 0; row < (int64_t) full * full; row++){
+    row_band(geo, row, 0, geo->edge, &first, &last);
+    for (i = first; i < last; i++){
+      index = row * size + i;
+      norms = geo->shell[index];
+      f1 = get_coef(half1, index);
+      f2 = get_coef(half2, index);
+      x[0] = sqrt(fabs(creal(f1 * conj(f1))));
+      x[1] = sqrt(fabs(creal(f2 * conj(f2))));
+      x[2] = creal(f1 * conj(f2));
+      x[3] = creal(f1 * conj(f1));
+      x[4] = creal(f2 * conj(f2));
+      for (k = 0; k < 5; k++){
+        ref_add(sref[norms][k], x[k]);
+        sraw[norms][k] += x[k];
+      }
+      n[norms]++;
+    }
+  }
+  // Shell zero holds the mean after the spectrum is taken
+  for (i = 1; i < full; i++){
+    if (n[i] == 0){
+      continue;
+    }
+    for (k = 0; k < 5; k++){
+      x[k] = sref[i][k][0] + sref[i][k][1];
+    }
+    fsc = fabsl(x[2] / sqrtl(fabsl(x[3] * x[4])));
+    crf = sqrtl((2.0 * fsc) / (1.0 + fsc));
+    e = rel_err(spec1[i], crf * x[0] / n[i]);
+    err_ref = (e > err_ref) ? e : err_ref;
+    fsc = fabsl(sraw[i][2] / sqrtl(fabsl(sraw[i][3] * sraw[i][4])));
+    e = rel_err(sqrtl((2.0 * fsc) / (1.0 + fsc)) * sraw[i][0] / n[i], crf * x[0] / n[i]);
+    err_raw = (e > err_raw) ? e : err_raw;
+  }
+  printf("\t Spectrum | kernels = %e | long double = %e\n", err_ref, err_raw);
+  free(sref);
+  free(sraw);
+  free(n);
+  free(spec1);
+  free(spec2);
+  // Real-space power within the mask on compact copies - normalisation rescales its input
+  real_t *c1 = fftw_malloc(r_sz * sizeof(real_t));
+  real_t *c2 = fftw_malloc(r_sz * sizeof(real_t));
+  memcpy(c1, map1, r_sz * sizeof(real_t));
+  memcpy(c2, map2, r_sz * sizeof(real_t));
+  memset(&node, 0, sizeof(list));
+  normalise(c1, c2, NULL, NULL, mask, &node, full, full, stage->real);
+  memset(ref, 0, sizeof(ref));
+  memset(raw, 0, sizeof(raw));
+  long double count = 0.0, pwr;
+  for (index = 0; index < r_sz; index++){
+    if (mask->data[index] < 0.99){
+      continue;
+    }
+    count += 1.0;
+    x[0] = map1[index] / r_sz + map2[index] / r_sz;
+    ref_add(ref[0], x[0] * x[0]);
+    raw[0] += x[0] * x[0];
+  }
+  pwr = sqrtl((ref[0][0] + ref[0][1]) / count);
+  printf("\t Power    | kernels = %e | long double = %e\n", rel_err(node.pwr, pwr), rel_err(sqrtl(raw[0] / count), pwr));
+  fflush(stdout);
+  fftw_free(c1);
+  fftw_free(c2);
+  return;
+}
+
+// Error of a result as stored in double relative to the reference
+double rel_err(double value, long double ref){
+  return (double) fabsl((value - ref) / ref);
+}
+
+// Add x to the compensated long double sum held in acc
+void ref_add(long double *acc, long double x){
+  long double t = acc[0] + x;
+  long double z = t - acc[0];
+  acc[1] += (acc[0] - (t - z)) + (x - z);
+  acc[0] = t;
+  return;
+}
+
+// Time each stage at increasing thread counts and keep the fastest
+void tune_jobs(jobs *stage, r_mrc *mask, int32_t full, int32_t nthreads){
+  int64_t r_sz = (int64_t) full * full * full;
+  double best_fft = DBL_MAX, best_fou = DBL_MAX, best_real = DBL_MAX;
+  double t_fft, t_fou, t_real;
+  int32_t t;
+  real_t *r1 = fftw_malloc(r_sz * sizeof(real_t));
+  real_t *r2 = fftw_malloc(r_sz * sizeof(real_t));
+  real_t *r3 = fftw_malloc(r_sz * sizeof(real_t));
+  real_t *r4 = fftw_malloc(r_sz * sizeof(real_t));
+  fftw_complex *k1 = fftw_malloc(fourier_bytes(full));
+  fftw_complex *k2 = fftw_malloc(fourier_bytes(full));
+  zero_real(r1, full, nthreads);
+  zero_real(r2, full, nthreads);
+  zero_real(r3, full, nthreads);
+  zero_real(r4, full, nthreads);
+  zero_fourier(k1, full, nthreads);
+  zero_fourier(k2, full, nthreads);
+  printf("\n\t Tuning thread counts for %i^3 maps\n\n", full);
+  fflush(stdout);
+  t = 1;
+  while (1){
+    t_fft = time_fft(k1, r1, full, t);
+    t_fou = time_fourier(k1, k2, full, t);
+    t_real = time_real(r1, r2, r3, r4, mask, full, t);
+    printf("\t Threads = %4i | FFT = %10.6f s | Fourier = %10.6f s | Real = %10.6f s\n", t, t_fft, t_fou, t_real);
+    fflush(stdout);
+    if (t_fft < best_fft){
+      best_fft = t_fft;
+      stage->fft = t;
+    }
+    if (t_fou < best_fou){
+      best_fou = t_fou;
+      stage->fourier = t;
+    }
+    if (t_real < best_real){
+      best_real = t_real;
+      stage->real = t;
+    }
+    if (t == nthreads){
+      break;
+    }
+    // Powers of two then all threads
+    t = (t * 2 < nthreads) ? t * 2 : nthreads;
+  }
+  fftw_free(r1);
+  fftw_free(r2);
+  fftw_free(r3);
+  fftw_free(r4);
+  fftw_free(k1);
+  fftw_free(k2);
+  return;
+}
+
+double tune_clock(void){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double) now.tv_sec + 1e-9 * (double) now.tv_nsec;
+}
+
+void tune_fill(real_t *map, int64_t size){
+  for (int64_t i = 0; i < size; i++){
+    map[i] = 1.0;
+  }
+  return;
+}
+
+double time_fft(fftw_complex *in, real_t *out, int32_t full, int32_t nthreads){
+  double start, best = DBL_MAX;
+  fftw_plan_with_nthreads(nthreads);
+  fftw_plan plan = plan_c2r(full, in, out, FFTW_ESTIMATE);
+  for (int32_t i = 0; i < TUNE_REPEATS; i++){
+    start = tune_clock();
+    fftw_execute(plan);
+    start = tune_clock() - start;
+    best = (start < best) ? start : best;
+  }
+  fftw_destroy_plan(plan);
+  return best;
+}
+
+double time_fourier(fftw_complex *in, fftw_complex *out, int32_t full, int32_t nthreads){
+  double start, best = DBL_MAX;
+  list node;
+  memset(&node, 0, sizeof(list));
+  node.res = 0.1;
+  node.stp = 0.05;
+  for (int32_t i = 0; i < TUNE_REPEATS; i++){
+    start = tune_clock();
+    // Same map stands in for both halves
+    bandpass_pair(in, in, out, out, &node, full, nthreads);
+    start = tune_clock() - start;
+    best = (start < best) ? start : best;
+  }
+  return best;
+}
+
+double time_fsc(fftw_complex *in1, fftw_complex *in2, int32_t full, int32_t nthreads){
+  double start, best = DBL_MAX;
+  for (int32_t i = 0; i < TUNE_REPEATS; i++){
+    start = tune_clock();
+    calc_fsc(in1, in2, full, nthreads);
+    start = tune_clock() - start;
+    best = (start < best) ? start : best;
+  }
+  return best;
+}
+
+double time_spectrum(fftw_complex *in1, fftw_complex *in2, int32_t full, int32_t nthreads){
+  double start, best = DBL_MAX;
+  double *spec1 = calloc(full, sizeof(double));
+  double *spec2 = calloc(full, sizeof(double));
+  for (int32_t i = 0; i < TUNE_REPEATS; i++){
+    start = tune_clock();
+    get_spectrum(in1, in2, spec1, spec2, full, nthreads);
+    start = tune_clock() - start;
+    best = (start < best) ? start : best;
+  }
+  free(spec1);
+  free(spec2);
+  return best;
+}
+
+double time_real(real_t *in1, real_t *in2, real_t *out1, real_t *out2, r_mrc *mask, int32_t full, int32_t nthreads){
+  double start, best = DBL_MAX;
+  int64_t size = (int64_t) full * full * full;
+  list node;
+  memset(&node, 0, sizeof(list));
+  node.stp = 0.05;
+  for (int32_t i = 0; i < TUNE_REPEATS; i++){
+    // Normalisation rescales the input so refill it untimed
+    tune_fill(in1, size);
+    tune_fill(in2, size);
+    start = tune_clock();
+    normalise(in1, in2, out1, out2, mask, &node, full, full, nthreads);
+    apply_mask(mask, out1, nthreads);
+    start = tune_clock() - start;
+    best = (start < best) ? start : best;
+  }
+  return best;
+}
+
+int8_t read_profile(char *profile, jobs *stage, int32_t full, int32_t nthreads){
+  char line[256];
+  int32_t size, threads, fft, fourier, real;
+  int8_t found = 0;
+  FILE *f = fopen(profile, "r");
+  if (!f){
+    return 0;
+  }
+  while (fgets(line, sizeof(line), f)){
+    if (line[0] == '#'){
+      continue;
+    }
+    if (sscanf(line, "%i %i %i %i %i", &size, &threads, &fft, &fourier, &real) == 5 && size == full && threads == nthreads){
+      stage->fft = fft;
+      stage->fourier = fourier;
+      stage->real = real;
+      found = 1;
+    }
+  }
+  fclose(f);
+  return found;
+}
+
+void write_profile(char *profile, jobs *stage, int32_t full, int32_t nthreads){
+  char line[256];
+  int32_t size, threads;
+  size_t length = 0, used = 0;
+  char *keep = calloc(1, 1);
+  FILE *f = fopen(profile, "r");
+  // Keep entries for other box sizes and thread counts
+  if (f){
+    while (fgets(line, sizeof(line), f)){
+      // Drop header and any stale entry for this box and thread count
+      if (line[0] == '#' || (sscanf(line, "%i %i", &size, &threads) == 2 && size == full && threads == nthreads)){
+        continue;
+      }
+      length = strlen(line);
+      keep = realloc(keep, used + length + 1);
+      memcpy(keep + used, line, length + 1);
+      used += length;
+    }
+    fclose(f);
+  }
+  f = fopen(profile, "w");
+  if (!f){
+    printf("\n\t Error writing profile %s - bad file handle\n", profile);
+    free(keep);
+    return;
+  }
+  fprintf(f, "# SIDESPLITTER thread profile: box threads fft fourier real\n");
+  fputs(keep, f);
+  fprintf(f, "%i %i %i %i %i\n", full, nthreads, stage->fft, stage->fourier, stage->real);
+  fclose(f);
+  free(keep);
+  printf("\n\t Thread counts saved to profile %s\n", profile);
+  return;
+}
@@ -0,0 +1,74 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Inclusions
+#include <stdio.h>
+#include <signal.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <complex.h>
+#include <fftw3.h>
+#include <time.h>
+
+// Timed repeats per thread count
+#define TUNE_REPEATS 3
+
+double rel_err(double value, long double ref);
+// Relative error of value rounded to double
+
+void ref_add(long double *acc, long double x);
+// Compensated long double sum - acc holds sum and error
+
+void tune_jobs(jobs *stage, r_mrc *mask, int32_t full, int32_t nthreads);
+// Time stages for each thread count
+// Keeps fastest count per stage
+
+double tune_clock(void);
+// Monotonic time in seconds
+
+void tune_fill(real_t *map, int64_t size);
+// Refill map with unit values
+
+double time_fft(fftw_complex *in, real_t *out, int32_t full, int32_t nthreads);
+// Best time for inverse FFT
+
+double time_fourier(fftw_complex *in, fftw_complex *out, int32_t full, int32_t nthreads);
+// Best time for filter and FSC
+
+double time_fsc(fftw_complex *in1, fftw_complex *in2, int32_t full, int32_t nthreads);
+// Best time for FSC sum
+
+double time_spectrum(fftw_complex *in1, fftw_complex *in2, int32_t full, int32_t nthreads);
+// Best time for spectrum histogram
+
+double time_real(real_t *in1, real_t *in2, real_t *out1, real_t *out2, r_mrc *mask, int32_t full, int32_t nthreads);
+// Best time for real-space statistics
+
+int8_t read_profile(char *profile, jobs *stage, int32_t full, int32_t nthreads);
+// Read matching profile entry
+// Returns 1 if found
+
+void write_profile(char *profile, jobs *stage, int32_t full, int32_t nthreads);
+// Replace matching profile entry
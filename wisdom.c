@@ -0,0 +1,241 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Library header inclusion for linking
+#define _GNU_SOURCE
+#include "sidesplitter.h"
+#include "wisdom.h"
+
+// Import stored wisdom for this box, thread count, precision and CPU
+int8_t read_wisdom(char *store, int32_t full, int32_t nthreads){
+  char key[MODEL_LENGTH + 32], *line = NULL, *text = calloc(1, 1);
+  size_t length = 0, used = 0, n;
+  int8_t match = 0, found = 0;
+  FILE *f = fopen(store, "r");
+  if (!f){
+    free(text);
+    return 0;
+  }
+  wisdom_key(key, sizeof(key), full, nthreads);
+  while (getline(&line, &length, f) != -1){
+    if (line[0] == '@'){
+      match = !strcmp(line, key);
+      continue;
+    }
+    if (!match){
+      continue;
+    }
+    n = strlen(line);
+    text = realloc(text, used + n + 1);
+    memcpy(text + used, line, n + 1);
+    used += n;
+  }
+  fclose(f);
+  if (used){
+    found = fftw_import_wisdom_from_string(text) ? 1 : 0;
+  }
+  free(line);
+  free(text);
+  return found;
+}
+
+// Replace the stored section for this box, thread count, precision and CPU with current wisdom
+void write_wisdom(char *store, int32_t full, int32_t nthreads){
+  char key[MODEL_LENGTH + 32], *line = NULL, *keep = calloc(1, 1), *old = calloc(1, 1);
+  size_t length = 0, used = 0, stale = 0, n;
+  int8_t match = 0;
+  // Concurrent runs take turns on a lock beside the store so none drops the sections of another
+  char *lock = malloc(strlen(store) + 8), *temp = malloc(strlen(store) + 8);
+  sprintf(lock, "%s.lock", store);
+  sprintf(temp, "%s.XXXXXX", store);
+  int fd = open(lock, O_RDWR | O_CREAT, 0644);
+  if (fd >= 0){
+    flock(fd, LOCK_EX);
+  }
+  FILE *f = fopen(store, "r");
+  wisdom_key(key, sizeof(key), full, nthreads);
+  // Keep sections for other boxes, thread counts, precisions and CPUs
+  if (f){
+    while (getline(&line, &length, f) != -1){
+      if (line[0] == '@'){
+        match = !strcmp(line, key);
+        if (match){
+          continue;
+        }
+      }
+      n = strlen(line);
+      if (match){
+        old = realloc(old, stale + n + 1);
+        memcpy(old + stale, line, n + 1);
+        stale += n;
+        continue;
+      }
+      if (line[0] == '#'){
+        continue;
+      }
+      keep = realloc(keep, used + n + 1);
+      memcpy(keep + used, line, n + 1);
+      used += n;
+    }
+    fclose(f);
+  }
+  char *wisdom = fftw_export_wisdom_to_string();
+  if (wisdom){
+    // Sections are stored ending in a newline
+    n = strlen(wisdom);
+    wisdom = realloc(wisdom, n + 2);
+    if (n && wisdom[n - 1] != '\n'){
+      strcpy(wisdom + n, "\n");
+    }
+  }
+  // Nothing new was planned
+  int8_t same = wisdom && !strcmp(old, wisdom);
+  int tmp = (!same && wisdom) ? mkstemp(temp) : -1;
+  if (tmp >= 0){
+    // Temporary files are private - the store is not
+    fchmod(tmp, 0644);
+  }
+  f = (tmp >= 0) ? fdopen(tmp, "w") : NULL;
+  if (!same && !f){
+    printf("\n\t Error writing FFTW wisdom %s - bad file handle\n", store);
+    if (tmp >= 0){
+      close(tmp);
+      unlink(temp);
+    }
+  } else if (!same){
+    fprintf(f, "# SIDESPLITTER FFTW wisdom: each section starts @ box threads precision cpu\n");
+    fputs(keep, f);
+    fputs(key, f);
+    fputs(wisdom, f);
+    // Readers see the old store or the new one, never a partial file
+    if (fclose(f) || rename(temp, store)){
+      printf("\n\t Error writing FFTW wisdom %s - bad file handle\n", store);
+      unlink(temp);
+    }
+  }
+  if (fd >= 0){
+    flock(fd, LOCK_UN);
+    close(fd);
+  }
+  free(line);
+  free(keep);
+  free(old);
+  free(lock);
+  free(temp);
+  free(wisdom);
+  return;
+}
+
+// Plan the transforms of each listed box size and store their wisdom
+void make_wisdom(arguments *args, int32_t nthreads){
+  char *sizes = strdup(args->wsz), *next, *save = NULL;
+  int32_t full, counts[3], ncounts, i;
+  jobs *stage;
+  // Split groups plan their transforms on the threads of each group
+  int8_t split = (args->half || args->look) && split_pool(nthreads);
+  printf("\n\t Generating FFTW wisdom in %s\n", args->wisd);
+  for (next = strtok_r(sizes, ",", &save); next; next = strtok_r(NULL, ",", &save)){
+    full = atoi(next);
+    if (full < 2){
+      printf("\n\t Box size %s not recognised - skipped\n", next);
+      continue;
+    }
+    stage = stage_jobs(args, NULL, full, nthreads);
+    // Each section holds the wisdom of one box only
+    fftw_forget_wisdom();
+    read_wisdom(args->wisd, full, stage->fft);
+    set_layout(args->soa, full);
+    counts[0] = stage->fft;
+    ncounts = 1;
+    for (i = 0; split && i < 2; i++){
+      if (split_threads(i, stage->fft) != counts[ncounts - 1] && split_threads(i, stage->fft) != counts[0]){
+        counts[ncounts++] = split_threads(i, stage->fft);
+      }
+    }
+    for (i = 0; i < ncounts; i++){
+      plan_wisdom(args, full, counts[i]);
+    }
+    write_wisdom(args->wisd, full, stage->fft);
+    printf("\t Wisdom stored for %i^3 maps on %i FFT threads", full, stage->fft);
+    for (i = 1; i < ncounts; i++){
+      printf("%s%i", (i == 1) ? " - groups of " : " and ", counts[i]);
+    }
+    printf("\n");
+    fflush(stdout);
+    free(stage);
+  }
+  free(sizes);
+  return;
+}
+
+// Plan every transform a run makes for one box on nthreads
+void plan_wisdom(arguments *args, int32_t full, int32_t nthreads){
+  int32_t ring = (args->batch > 1) ? args->batch : 1;
+  fftw_plan plan;
+  real_t *r = fftw_malloc(ring * (int64_t) full * full * full * sizeof(real_t));
+  fftw_complex *k = fftw_malloc(ring * fourier_bytes(full));
+  fftw_plan_with_nthreads(nthreads);
+  plan = plan_r2c(full, r, k, plan_effort());
+  fftw_destroy_plan(plan);
+  plan = plan_c2r(full, k, r, plan_effort());
+  fftw_destroy_plan(plan);
+  if (ring > 1){
+    plan = plan_c2r_many(full, ring, k, r, plan_effort());
+    fftw_destroy_plan(plan);
+  }
+  if (args->inpl){
+    // In-place inverse transforms are planned apart from out-of-place ones
+    plan = plan_c2r(full, k, (real_t *) k, plan_effort());
+    fftw_destroy_plan(plan);
+    if (ring > 1){
+      plan = plan_c2r_many(full, ring, k, (real_t *) k, plan_effort());
+      fftw_destroy_plan(plan);
+    }
+  }
+  fftw_free(r);
+  fftw_free(k);
+  return;
+}
+
+void cpu_model(char *model, size_t length){
+  char line[512], *value;
+  FILE *f = fopen("/proc/cpuinfo", "r");
+  snprintf(model, length, "unknown");
+  if (!f){
+    return;
+  }
+  while (fgets(line, sizeof(line), f)){
+    if (!strncmp(line, "model name", 10) && (value = strchr(line, ':'))){
+      value += (value[1] == ' ') ? 2 : 1;
+      value[strcspn(value, "\n")] = '\0';
+      snprintf(model, length, "%s", value);
+      break;
+    }
+  }
+  fclose(f);
+  return;
+}
+
+void wisdom_key(char *key, size_t length, int32_t full, int32_t nthreads){
+  char model[MODEL_LENGTH];
+  cpu_model(model, sizeof(model));
+  snprintf(key, length, "@ %i %i %s %s\n", full, nthreads, PRECISION_NAME, model);
+  return;
+}
@@ -0,0 +1,48 @@
+
+/*                                                                         
+ * Copyright 14/08/2019 - Dr. Christopher H. S. Aylett                     
+ *                                                                         
+ * This program is free software; you can redistribute it and/or modify    
+ * it under the terms of version 3 of the GNU General Public License as    
+ * published by the Free Software Foundation.                              
+ *                                                                         
+ * This program is distributed in the hope that it will be useful,         
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of          
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           
+ * GNU General Public License for more details - YOU HAVE BEEN WARNED!     
+ *                                                                         
+ * Program: SIDESPLITTER V1.2                                               
+ *                                                                         
+ * Authors: Chris Aylett                                                   
+ *          Colin Palmer                                                   
+ *                                                                         
+ */
+
+// Inclusions
+#include <stdio.h>
+#include <signal.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <complex.h>
+#include <fftw3.h>
+
+// Longest CPU model name kept in a store key
+#define MODEL_LENGTH 256
+
+void plan_wisdom(arguments *args, int32_t full, int32_t nthreads);
+// Plan every transform a run makes for one box on nthreads
+
+void cpu_model(char *model, size_t length);
+// CPU model name from /proc/cpuinfo
+// Unknown if not found
+
+void wisdom_key(char *key, size_t length, int32_t full, int32_t nthreads);
+// Store section header for box, thread count, precision and CPU